@@ -0,0 +1,169 @@
+/*
+Copyright (C) 2025 DEV47APPS, github.com/dev47apps
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <math.h>
+#include <stdlib.h>
+#include "plugin.h"
+#include "audio_jitter.h"
+
+#define JITTER_MIN_TARGET  (20 * 1000000LL)
+#define JITTER_MAX_TARGET  (500 * 1000000LL)
+#define JITTER_MIN_SLACK   (20 * 1000000LL)    // below target before it's an underrun
+#define JITTER_MIN_EXCESS  (100 * 1000000LL)   // above target before it's an overrun
+#define DRIFT_GAIN_PPM     20000.0             // ppm per second of depth error
+#define DRIFT_MAX_PPM      1000.0
+
+AudioJitter::AudioJitter(void) {
+    out = NULL;
+    out_size = 0;
+    reset();
+}
+
+AudioJitter::~AudioJitter(void) {
+    if (out) bfree(out);
+}
+
+void AudioJitter::reset(void) {
+    next_ts = 0;
+    target = 0;
+    depth = 0;
+    jitter = 0;
+    last_transit = 0;
+    ratio = 1.0;
+    drift_ppm = 0;
+    phase = 0;
+    for (int i = 0; i < MAX_AV_PLANES; i++)
+        prev[i] = 0;
+
+    frames = 0;
+    underruns = 0;
+    overruns = 0;
+    depth_sum = 0;
+}
+
+void AudioJitter::log_stats(void) {
+    if (frames == 0)
+        return;
+
+    ilog("audio jitter buffer: %llu frames, depth avg %.1fms (target %.1fms, jitter %.1fms), "
+        "%llu underruns, %llu overruns, drift %+.1f ppm",
+        (unsigned long long) frames,
+        depth_sum / (double) frames / 1000000.0,
+        (double) target / 1000000.0,
+        jitter / 1000000.0,
+        (unsigned long long) underruns,
+        (unsigned long long) overruns,
+        drift_ppm);
+}
+
+void AudioJitter::process(struct obs_source_audio *frame, uint64_t ref, uint64_t pts, uint64_t now, bool adaptive) {
+    if (frame->samples_per_sec == 0 || frame->frames == 0)
+        return;
+
+    const int64_t frame_ns = (int64_t) frame->frames * 1000000000LL / frame->samples_per_sec;
+
+    if (adaptive && pts != NO_PTS) {
+        const int64_t transit = (int64_t) now - (int64_t) (pts * 1000);
+        if (last_transit)
+            jitter += ((double) llabs(transit - last_transit) - jitter) / 16.0;
+
+        last_transit = transit;
+    }
+
+    if (adaptive) {
+        target = (int64_t) (3.0 * jitter) + frame_ns;
+        if (target < JITTER_MIN_TARGET) target = JITTER_MIN_TARGET;
+        if (target > JITTER_MAX_TARGET) target = JITTER_MAX_TARGET;
+    } else {
+        target = 0;
+    }
+
+    if (next_ts) {
+        const int64_t d = (int64_t) next_ts - (int64_t) ref;
+        const int64_t slack = target > JITTER_MIN_SLACK ? target : JITTER_MIN_SLACK;
+        const int64_t excess = 2 * target > JITTER_MIN_EXCESS ? 2 * target : JITTER_MIN_EXCESS;
+
+        if (d < target - slack) {
+            dlog("audio jitter buffer underrun: depth %.1fms", (double) d / 1000000.0);
+            underruns ++;
+            next_ts = 0;
+        }
+        else if (d > target + excess) {
+            dlog("audio jitter buffer overrun: depth %.1fms", (double) d / 1000000.0);
+            overruns ++;
+            next_ts = 0;
+        }
+        else {
+            depth += ((double) d - depth) / 64.0;
+        }
+    }
+
+    if (next_ts == 0) {
+        next_ts = ref + target;
+        depth = (double) target;
+        phase = 0;
+    }
+
+    // deeper than wanted means the phone clock runs fast: emit fewer samples
+    double ppm = (depth - (double) target) / 1000000000.0 * DRIFT_GAIN_PPM;
+    if (ppm > DRIFT_MAX_PPM) ppm = DRIFT_MAX_PPM;
+    if (ppm < -DRIFT_MAX_PPM) ppm = -DRIFT_MAX_PPM;
+    ratio = 1.0 - ppm / 1000000.0;
+    drift_ppm += (ppm - drift_ppm) / 1024.0;
+
+    if (frame->format == AUDIO_FORMAT_FLOAT_PLANAR)
+        resample(frame, (int) get_audio_channels(frame->speakers));
+
+    frame->timestamp = next_ts;
+    next_ts += (uint64_t) frame->frames * 1000000000ULL / frame->samples_per_sec;
+
+    frames ++;
+    depth_sum += depth;
+}
+
+void AudioJitter::resample(struct obs_source_audio *frame, int channels) {
+    if (channels <= 0 || channels > MAX_AV_PLANES)
+        return;
+
+    const double step = 1.0 / ratio;
+    const uint32_t n = frame->frames;
+    const uint32_t size = (uint32_t) (n * step) + 2;
+    if (size > out_size) {
+        out = (float*) brealloc(out, sizeof(float) * size * channels);
+        out_size = size;
+    }
+
+    uint32_t count = 0;
+    double p = phase;
+    for (int ch = 0; ch < channels; ch++) {
+        const float *in = (const float*) frame->data[ch];
+        float *dst = &out[ch * out_size];
+
+        count = 0;
+        for (p = phase; p < (double) (n - 1); p += step) {
+            const int i = (int) floor(p);
+            const float frac = (float) (p - i);
+            const float a = (i < 0) ? prev[ch] : in[i];
+            dst[count++] = a + (in[i + 1] - a) * frac;
+        }
+
+        prev[ch] = in[n - 1];
+        frame->data[ch] = (const uint8_t*) dst;
+    }
+
+    phase = p - n;
+    frame->frames = count;
+}
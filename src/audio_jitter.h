@@ -0,0 +1,55 @@
+// Copyright (C) 2025 DEV47APPS, github.com/dev47apps
+#pragma once
+
+#include <stdint.h>
+
+extern "C" {
+#include <obs.h>
+}
+
+// Smooths decoded audio onto a continuous output timeline.
+//
+// Frames are re-stamped back to back (next_ts advances by exactly the
+// samples written) and run `target` ahead of their reference time, so
+// arrival jitter becomes a steady delay rather than gaps for OBS to paper
+// over. The target follows the measured arrival jitter (RFC 3550 style).
+//
+// Clock drift shows up as the buffer depth slowly walking away from the
+// target; a linear resampler stretches or squeezes planar float frames by
+// a few hundred ppm to pull it back. Larger excursions (stalls, bursts)
+// re-anchor the timeline instead and are counted as underruns/overruns.
+struct AudioJitter {
+    uint64_t next_ts;   // timestamp of the next output sample, 0 = not anchored
+    int64_t target;     // wanted depth, ns
+    double depth;       // smoothed next_ts - reference, ns
+    double jitter;      // smoothed arrival jitter, ns
+    int64_t last_transit;
+    double ratio;       // output/input sample ratio currently applied
+    double drift_ppm;   // long-term average of the ratio, as ppm
+
+    // resampler state
+    double phase;       // input position of the next output sample, -1 = previous frame's last
+    float prev[MAX_AV_PLANES];
+    float *out;
+    uint32_t out_size;  // samples per plane
+
+    uint64_t frames;
+    uint64_t underruns;
+    uint64_t overruns;
+    double depth_sum;
+
+    AudioJitter(void);
+    ~AudioJitter(void);
+
+    void reset(void);
+    void log_stats(void);
+
+    // Re-time (and possibly resample) `frame` in place. `ref` is when the frame
+    // is due without buffering: the arrival time, or its mapped pts with sync_av.
+    // `pts` (us, may be NO_PTS) is only used to measure arrival jitter.
+    // With `adaptive` false the target is 0, i.e. ref is already jitter-free.
+    void process(struct obs_source_audio *frame, uint64_t ref, uint64_t pts, uint64_t now, bool adaptive);
+
+private:
+    void resample(struct obs_source_audio *frame, int channels);
+};
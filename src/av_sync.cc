@@ -0,0 +1,142 @@
+/*
+Copyright (C) 2025 DEV47APPS, github.com/dev47apps
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdlib.h>
+#include "plugin.h"
+#include "av_sync.h"
+
+#define AV_CLOCK_WINDOW_NS  (4000000000ULL)
+#define AV_CLOCK_SLEW_NS    (250 * 1000)            // max offset change per packet
+#define AV_CLOCK_STEP_NS    (200 * 1000000LL)       // re-anchor instead of slewing
+#define AV_CLOCK_MAX_SKEW   (1000 * 1000000LL)      // streams further apart use separate clocks
+#define AV_LATENESS_WEIGHT  (1.0 / 16.0)
+
+void AVClock::reset(void) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (int i = 0; i < AV_STREAM_COUNT; i++) {
+        Stream *s = &streams[i];
+        s->offset = 0;
+        s->window_min = INT64_MAX;
+        s->prev_min = INT64_MAX;
+        s->window_start = 0;
+        s->valid = false;
+        s->lateness = 0;
+        s->outputs = 0;
+    }
+
+    clock_mismatch = false;
+    skew_avg = 0;
+    skew_max = 0;
+    skew_samples = 0;
+}
+
+void AVClock::log_stats(void) {
+    std::lock_guard<std::mutex> guard(lock);
+    const Stream *v = &streams[AV_STREAM_VIDEO];
+    const Stream *a = &streams[AV_STREAM_AUDIO];
+    if (v->outputs == 0)
+        return;
+
+    ilog("av sync: video offset %.1fms, audio offset %.1fms%s, lip-sync error avg %.1fms max %.1fms (%llu samples)",
+        (double) v->offset / 1000000.0,
+        (double) a->offset / 1000000.0,
+        clock_mismatch ? " (separate clocks)" : "",
+        skew_avg / 1000000.0,
+        (double) skew_max / 1000000.0,
+        (unsigned long long) skew_samples);
+}
+
+void AVClock::observe(AVStream stream, uint64_t pts, uint64_t now) {
+    std::lock_guard<std::mutex> guard(lock);
+    Stream *s = &streams[stream];
+    const int64_t delta = (int64_t) now - (int64_t) (pts * 1000);
+
+    if (s->window_start == 0 || now - s->window_start > AV_CLOCK_WINDOW_NS) {
+        s->prev_min = s->window_min;
+        s->window_min = INT64_MAX;
+        s->window_start = now;
+    }
+
+    if (delta < s->window_min)
+        s->window_min = delta;
+
+    const int64_t target = s->window_min < s->prev_min ? s->window_min : s->prev_min;
+    if (!s->valid || llabs(target - s->offset) > AV_CLOCK_STEP_NS) {
+        s->offset = target;
+        s->valid = true;
+        return;
+    }
+
+    if (target > s->offset + AV_CLOCK_SLEW_NS)
+        s->offset += AV_CLOCK_SLEW_NS;
+    else if (target < s->offset - AV_CLOCK_SLEW_NS)
+        s->offset -= AV_CLOCK_SLEW_NS;
+    else
+        s->offset = target;
+}
+
+int64_t AVClock::shared_offset(AVStream stream) {
+    const Stream *s = &streams[stream];
+    const Stream *o = &streams[stream == AV_STREAM_VIDEO ? AV_STREAM_AUDIO : AV_STREAM_VIDEO];
+    if (!o->valid)
+        return s->offset;
+
+    if (llabs(s->offset - o->offset) > AV_CLOCK_MAX_SKEW) {
+        if (!clock_mismatch) {
+            clock_mismatch = true;
+            ilog("av sync: audio and video pts are %.0fms apart, not sharing a clock",
+                (double) llabs(s->offset - o->offset) / 1000000.0);
+        }
+        return s->offset;
+    }
+
+    return s->offset < o->offset ? s->offset : o->offset;
+}
+
+uint64_t AVClock::map(AVStream stream, uint64_t pts) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!streams[stream].valid)
+        return 0;
+
+    return (uint64_t) ((int64_t) (pts * 1000) + shared_offset(stream));
+}
+
+void AVClock::output(AVStream stream, uint64_t timestamp, uint64_t now) {
+    std::lock_guard<std::mutex> guard(lock);
+    Stream *s = &streams[stream];
+    const double lateness = (double) ((int64_t) now - (int64_t) timestamp);
+
+    s->lateness = (s->outputs == 0) ? lateness
+        : s->lateness + (lateness - s->lateness) * AV_LATENESS_WEIGHT;
+    s->outputs ++;
+
+    const Stream *v = &streams[AV_STREAM_VIDEO];
+    const Stream *a = &streams[AV_STREAM_AUDIO];
+    if (stream != AV_STREAM_VIDEO || a->outputs == 0)
+        return;
+
+    const double skew = v->lateness - a->lateness;
+    skew_avg = (skew_samples == 0) ? skew
+        : skew_avg + (skew - skew_avg) * AV_LATENESS_WEIGHT;
+    skew_samples ++;
+
+    if (llabs((int64_t) skew) > llabs(skew_max))
+        skew_max = (int64_t) skew;
+
+    if ((skew_samples % 1024) == 0)
+        dlog("av sync: lip-sync error %.1fms (video late %.1fms, audio late %.1fms)",
+            skew / 1000000.0, v->lateness / 1000000.0, a->lateness / 1000000.0);
+}
@@ -0,0 +1,63 @@
+// Copyright (C) 2025 DEV47APPS, github.com/dev47apps
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+
+enum AVStream {
+    AV_STREAM_VIDEO,
+    AV_STREAM_AUDIO,
+    AV_STREAM_COUNT,
+};
+
+// Maps phone PTS (microseconds) onto the host clock (os_gettime_ns).
+//
+// Each stream estimates host - phone from its packet arrivals: network and
+// queueing delay only ever add to (arrival - pts), so the minimum over the
+// last few seconds is the best guess at the clock offset. The estimate is
+// slewed rather than stepped, so output timestamps stay smooth.
+// When both streams agree on the phone clock, they share the smaller offset,
+// which keeps audio and video with the same PTS on the same host timestamp.
+//
+// Lip-sync error is how much later video is output relative to its
+// timestamp than audio is (positive = video behind audio).
+struct AVClock {
+    struct Stream {
+        int64_t offset;     // applied host - phone offset, ns
+        int64_t window_min; // min(arrival - pts) in the current window
+        int64_t prev_min;   // ... and in the previous one
+        uint64_t window_start;
+        bool valid;
+
+        double lateness;    // moving average of output time - timestamp, ns
+        uint64_t outputs;
+    };
+
+    std::mutex lock;
+    Stream streams[AV_STREAM_COUNT];
+    bool clock_mismatch;
+
+    double skew_avg;
+    int64_t skew_max;
+    uint64_t skew_samples;
+
+    AVClock(void) {
+        reset();
+    }
+
+    // Start over for a new connection
+    void reset(void);
+    void log_stats(void);
+
+    // Packet with `pts` (us) arrived at host time `now`
+    void observe(AVStream stream, uint64_t pts, uint64_t now);
+
+    // Host timestamp (ns) for `pts` (us). Returns 0 until the stream has been observed.
+    uint64_t map(AVStream stream, uint64_t pts);
+
+    // Frame with host `timestamp` was handed to OBS at `now`
+    void output(AVStream stream, uint64_t timestamp, uint64_t now);
+
+private:
+    int64_t shared_offset(AVStream stream);
+};
@@ -2,8 +2,15 @@
 #ifndef __DECODER_H__
 #define __DECODER_H__
 
+#include <atomic>
 #include <deque>
 #include <mutex>
+#include <vector>
+#include "nal_scan.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
 template<typename T>
 struct Queue {
@@ -18,89 +25,515 @@ struct Queue {
 
     T next_item(void) {
         T item{};
+        items_lock.lock();
         if (items.size()) {
-            items_lock.lock();
             item = items.front();
-            items.erase(items.begin());
-            items_lock.unlock();
+            items.pop_front();
         }
+        items_lock.unlock();
         return item;
     }
 };
 
+#define CACHE_LINE 64
+
+// Bounded single-producer/single-consumer ring.
+// push() must only be called from one thread, and pop() from one thread.
+// Both are wait-free; size() is exact at the time of the call.
+template<typename T, size_t N>
+struct SPSCQueue {
+    static_assert((N & (N - 1)) == 0, "SPSCQueue size must be a power of two");
+
+    alignas(CACHE_LINE) std::atomic<size_t> head; // written by consumer
+    alignas(CACHE_LINE) std::atomic<size_t> tail; // written by producer
+    alignas(CACHE_LINE) T items[N];
+
+    SPSCQueue(void) : head(0), tail(0) {}
+
+    bool push(T item) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N)
+            return false;
+
+        items[t & (N - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    T pop(void) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return T{};
+
+        T item = items[h & (N - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return item;
+    }
+
+    size_t size(void) const {
+        const size_t h = head.load(std::memory_order_acquire);
+        return tail.load(std::memory_order_acquire) - h;
+    }
+};
+
+// Packet buffers come in power-of-two size classes so they can be
+// recycled between frames of similar size without reallocating.
+#define PACKET_MIN_SIZE (64 * 1024)
+#define PACKET_HUGE_SIZE (2 * 1024 * 1024)
+
+static inline size_t packet_size_class(size_t size) {
+    size_t c = PACKET_MIN_SIZE;
+    while (c < size) c <<= 1;
+    return c;
+}
+
 struct DataPacket {
     uint8_t *data;
     size_t size;
     size_t used;
+    bool mapped; // data came from mmap(), not bmalloc()
     uint64_t pts;
+    uint64_t recv_ts; // os_gettime_ns() when the frame finished arriving
+    bool keyframe;
+    uint32_t generation;
+    FrameType frame_type;
 
+    // Only the payload is left uninitialized
     DataPacket(size_t new_size) {
         size = 0;
         data = 0;
+        used = 0;
+        mapped = false;
+        pts = 0;
+        recv_ts = 0;
+        keyframe = false;
+        generation = 0;
+        frame_type = FRAME_UNKNOWN;
         resize(new_size);
     }
 
     ~DataPacket(void) {
-        if (data) bfree(data);
+        release();
+    }
+
+    // Contents are not preserved: packets are always refilled after a resize.
+    // Returns true if a new buffer was allocated.
+    bool resize(size_t new_size) {
+        if (size >= new_size)
+            return false;
+
+        release();
+        size = packet_size_class(new_size);
+
+        #ifdef __linux__
+        // Large buffers are mapped directly so they can be backed by transparent huge pages
+        if (size >= PACKET_HUGE_SIZE) {
+            void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, size, MADV_HUGEPAGE);
+                data = (uint8_t*) p;
+                mapped = true;
+                return true;
+            }
+        }
+        #endif
+
+        data = (uint8_t*) bmalloc(size);
+        return true;
     }
 
-    void resize(size_t new_size) {
-        if (size < new_size){
-            data = (uint8_t*) brealloc(data, new_size);
-            size = new_size;
+private:
+    void release(void) {
+        if (!data)
+            return;
+
+        #ifdef __linux__
+        if (mapped) {
+            munmap(data, size);
+            data = 0;
+            mapped = false;
+            return;
         }
+        #endif
+
+        bfree(data);
+        data = 0;
     }
 };
 
+// waiting longer than this for a keyframe after an error escalates to a reconnect
+#define RESYNC_TIMEOUT_NS UINT64_C(5000000000)
+
+#define DECODE_QUEUE_SIZE 128
+
+// What to do when a queued video packet is older than the latency budget
+enum DropPolicy {
+    DROP_TO_KEYFRAME, // drop it and everything after it until the next keyframe
+    DROP_OLDEST,      // drop only the late packet
+    DROP_NEVER,
+};
+
+enum DropReason {
+    DROP_LATE,
+    DROP_SUPERSEDED,  // independent frame, a newer one was queued
+    DROP_KEYFRAME_WAIT,
+    DROP_QUEUE_FULL,
+    DROP_DECODER_FAILED,
+    DROP_STALE,       // queued before a reconnect
+    DROP_BACKLOG,     // skipped in the socket, see FrameReader
+    DROP_REASON_COUNT,
+};
+
+static const char* DropReasonNames[DROP_REASON_COUNT] = {
+    "late", "superseded", "keyframe_wait", "queue_full", "decoder_failed", "stale", "backlog",
+};
+
+// How a decoder may spread work across threads, see FFMpegDecoder/MJpegDecoder
+enum DecodeThreading {
+    THREADING_AUTO,
+    THREADING_SLICE, // lowest latency: work is split within a frame, or not at all
+    THREADING_FRAME, // best throughput: consecutive frames decode in parallel
+};
+
+// Packet flow:
+//  receive thread: pull_empty_packet() -> fill -> push_ready_packet() -> decodeQueue
+//  decode thread:  pull_ready_packet() -> decode -> push_empty_packet() -> recieveQueue
+// The receive thread returns packets it drops itself with recycle_packet().
+// When receive and decode run on the same thread (audio), only recycle_packet() is used.
 struct Decoder {
-    Queue<DataPacket*> recieveQueue;
-    Queue<DataPacket*> decodeQueue;
-    size_t alloc_count;
+    SPSCQueue<DataPacket*, DECODE_QUEUE_SIZE * 2> recieveQueue;
+    SPSCQueue<DataPacket*, DECODE_QUEUE_SIZE> decodeQueue;
+    std::vector<DataPacket*> spare;
+    std::atomic<size_t> alloc_count;
     volatile bool ready;
     volatile bool failed;
 
+    // set before init()
+    enum DecodeThreading threading;
+    int width_hint, height_hint;
+
+    // Warm restart: the receive thread bumps `generation` when it reuses the
+    // decoder for a new connection; the decode thread flushes codec state
+    // when it sees the first packet of the new generation.
+    std::atomic<uint32_t> generation;
+    uint32_t decode_generation;
+
+    // Phone pts (us) of the frame decode_video() last returned. NO_PTS when
+    // the codec had none for it and the frame is stamped with host time.
+    uint64_t frame_pts;
+
+    // latency budget backpressure, applied by the decode thread
+    volatile DropPolicy drop_policy;
+    volatile uint64_t latency_budget_ns;
+    bool catchup;
+    std::atomic<uint64_t> drops[DROP_REASON_COUNT];
+    uint64_t last_pts; // decode thread, for frame_interval_ns
+    uint64_t frame_interval_ns; // smoothed pts step between packets
+
+    // error recovery: flush and resync at the next keyframe, up to
+    // recovery_limit times per recovery_window_ns, then give up (failed)
+    // so the connection is reset. Updated by the decode thread.
+    volatile int recovery_limit;
+    volatile uint64_t recovery_window_ns;
+    uint64_t recovery_start;
+    int recovery_count;
+    uint64_t resync_start;
+    std::atomic<uint64_t> recoveries;
+    std::atomic<uint64_t> escalations;
+
+    // packet buffer allocations, and bytes zeroed for decoder padding
+    uint64_t alloc_calls;
+    uint64_t alloc_bytes;
+    uint64_t zeroed_bytes;
+
+    // receive-to-decode queue latency, updated by the decode thread
+    uint64_t wait_count;
+    uint64_t wait_total_ns;
+    uint64_t wait_max_ns;
+
     Decoder(void) {
+        drop_policy = DROP_TO_KEYFRAME;
+        latency_budget_ns = 0;
+        catchup = false;
+        for (int i = 0; i < DROP_REASON_COUNT; i++)
+            drops[i] = 0;
+        last_pts = 0;
+        frame_interval_ns = 0;
+
+        recovery_limit = 5;
+        recovery_window_ns = UINT64_C(60000000000);
+        recovery_start = 0;
+        recovery_count = 0;
+        resync_start = 0;
+        recoveries = 0;
+        escalations = 0;
+
+        alloc_calls = 0;
+        alloc_bytes = 0;
+        zeroed_bytes = 0;
+        wait_count = 0;
+        wait_total_ns = 0;
+        wait_max_ns = 0;
         alloc_count = 0;
         ready = false;
         failed = false;
+        threading = THREADING_AUTO;
+        width_hint = height_hint = 0;
+        generation = 0;
+        decode_generation = 0;
+        frame_pts = NO_PTS;
     }
 
     virtual ~Decoder(void) {
         DataPacket* packet;
-        while ((packet = recieveQueue.next_item()) != NULL) {
+        while ((packet = recieveQueue.pop()) != NULL) {
             delete packet;
             alloc_count --;
         }
-        while ((packet = decodeQueue.next_item()) != NULL){
+        while ((packet = decodeQueue.pop()) != NULL){
             delete packet;
             alloc_count --;
         }
+        for (DataPacket* p : spare) {
+            delete p;
+            alloc_count --;
+        }
         if (alloc_count)
-        ilog("~decoder alloc_count=%lu", alloc_count);
+        ilog("~decoder alloc_count=%lu", (unsigned long) alloc_count.load());
+
+        if (alloc_calls)
+        ilog("~decoder buffers: %llu allocations, %llu KB allocated, %llu KB zeroed",
+            (unsigned long long) alloc_calls,
+            (unsigned long long) alloc_bytes / 1024,
+            (unsigned long long) zeroed_bytes / 1024);
+
+        for (int i = 0; i < DROP_REASON_COUNT; i++) {
+            if (drops[i])
+            ilog("~decoder dropped %llu packets: %s",
+                (unsigned long long) drops[i].load(), DropReasonNames[i]);
+        }
+
+        if (recoveries || escalations)
+        ilog("~decoder error recovery: %llu resyncs, %llu escalated to reconnect",
+            (unsigned long long) recoveries.load(),
+            (unsigned long long) escalations.load());
+
+        if (wait_count)
+        ilog("~decoder queue latency: avg=%.2fms max=%.2fms (%llu packets)",
+            (double) wait_total_ns / (double) wait_count / 1000000.0,
+            (double) wait_max_ns / 1000000.0,
+            (unsigned long long) wait_count);
+    }
+
+    inline void track_wait(DataPacket* packet, uint64_t now) {
+        uint64_t wait = now > packet->recv_ts ? now - packet->recv_ts : 0;
+        wait_total_ns += wait;
+        if (wait > wait_max_ns) wait_max_ns = wait;
+        wait_count ++;
+    }
+
+    // Decode thread: returns true if the packet should be dropped,
+    // based on how long it waited in the queue.
+    bool drop_late_packet(DataPacket* packet, uint64_t now) {
+        track_interval(packet->pts);
+        if (catchup) {
+            if (!packet->keyframe) {
+                if (resync_start && now - resync_start > RESYNC_TIMEOUT_NS)
+                    escalate("no keyframe after error");
+
+                drops[DROP_KEYFRAME_WAIT] ++;
+                return true;
+            }
+
+            dlog("decoder catchup: resume at keyframe");
+            catchup = false;
+            resync_start = 0;
+        }
+
+        const uint64_t age = now > packet->recv_ts ? now - packet->recv_ts : 0;
+        if (drop_policy == DROP_NEVER || latency_budget_ns == 0)
+            return false;
+
+        // Frames that stand alone (MJPEG) can go as soon as a newer one is
+        // queued, so their budget is one frame interval (if that is shorter).
+        if (independent_frames() && decodeQueue.size() > 0) {
+            const uint64_t budget = frame_interval_ns && frame_interval_ns < latency_budget_ns
+                ? frame_interval_ns : latency_budget_ns;
+            if (age > budget) {
+                dlog("drop superseded frame: %.1fms", (double) age / 1000000.0);
+                drops[DROP_SUPERSEDED] ++;
+                return true;
+            }
+        }
+
+        if (age <= latency_budget_ns)
+            return false;
+
+        if (drop_policy == DROP_TO_KEYFRAME) {
+            // a late keyframe is still the best place to resync
+            if (packet->keyframe)
+                return false;
+
+            // nothing references a non-ref frame, so it can go on its own
+            if (packet->frame_type != FRAME_NONREF)
+                catchup = true;
+        }
+
+        dlog("drop late %s packet: %.1fms", frame_type_name(packet->frame_type), (double) age / 1000000.0);
+        drops[DROP_LATE] ++;
+        return true;
+    }
+
+    // Decode thread: follow the stream's frame rate from packet pts (us)
+    inline void track_interval(uint64_t pts) {
+        if (last_pts && pts > last_pts && pts - last_pts < 1000000) {
+            const uint64_t step = (pts - last_pts) * 1000;
+            frame_interval_ns = frame_interval_ns ? (frame_interval_ns * 7 + step) / 8 : step;
+        }
+        last_pts = pts;
+    }
+
+    // Decode thread: returns true if the packet should be dropped because it
+    // belongs to a previous connection. Flushes on the first packet of a new one.
+    bool check_generation(DataPacket* packet) {
+        if (packet->generation != generation) {
+            drops[DROP_STALE] ++;
+            return true;
+        }
+
+        if (packet->generation != decode_generation) {
+            decode_generation = packet->generation;
+            flush();
+        }
+
+        return false;
+    }
+
+    // Decode thread: discard codec state, and wait for a keyframe to resume
+    virtual void flush(void) {
+        catchup = true;
+    }
+
+    // Decode thread: call after a decode error.
+    // Returns false if the error limit was reached and the decoder gave up.
+    bool recover(uint64_t now) {
+        if (recovery_start == 0 || now - recovery_start > recovery_window_ns) {
+            recovery_start = now;
+            recovery_count = 0;
+        }
+
+        if (++recovery_count > recovery_limit) {
+            escalate("too many errors");
+            return false;
+        }
+
+        dlog("decoder recovery %d/%d: flush and wait for keyframe", recovery_count, recovery_limit);
+        recoveries ++;
+        flush();
+        if (!resync_start) resync_start = now;
+        return true;
+    }
+
+    void escalate(const char *reason) {
+        if (failed)
+            return;
+
+        elog("decoder failed (%s), resetting connection", reason);
+        escalations ++;
+        failed = true;
+    }
+
+    inline size_t free_count(void) {
+        return spare.size() + recieveQueue.size();
     }
 
     inline DataPacket* pull_ready_packet(void) {
-        return decodeQueue.next_item();
+        return decodeQueue.pop();
     }
 
-    DataPacket* pull_empty_packet(size_t size) {
-        DataPacket* packet = recieveQueue.next_item();
-        if (!packet) {
+    virtual DataPacket* pull_empty_packet(size_t size) {
+        DataPacket* packet;
+        while ((packet = recieveQueue.pop()) != NULL)
+            spare.push_back(packet);
+
+        // Best fit: the smallest free buffer that holds `size`,
+        // otherwise grow the largest one.
+        size_t best = spare.size();
+        for (size_t i = 0; i < spare.size(); i++) {
+            if (best == spare.size()) {
+                best = i;
+                continue;
+            }
+
+            const size_t have = spare[i]->size;
+            const size_t have_best = spare[best]->size;
+            if (have_best < size ? have > have_best : (have >= size && have < have_best))
+                best = i;
+        }
+
+        if (best < spare.size()) {
+            packet = spare[best];
+            spare[best] = spare.back();
+            spare.pop_back();
+            if (packet->resize(size)) {
+                alloc_calls ++;
+                alloc_bytes += packet->size;
+            }
+        } else {
             packet = new DataPacket(size);
-            dlog("@decoder alloc: size=%ld", size);
+            dlog("@decoder alloc: size=%ld", packet->size);
             alloc_count ++;
-        } else {
-            packet->resize(size);
+            alloc_calls ++;
+            alloc_bytes += packet->size;
         }
+
         packet->used = 0;
         return packet;
     }
 
+    // decode thread
     inline void push_empty_packet(DataPacket* packet) {
-        recieveQueue.add_item(packet);
+        if (!recieveQueue.push(packet)) {
+            delete packet;
+            alloc_count --;
+        }
+    }
+
+    // receive thread
+    inline void recycle_packet(DataPacket* packet) {
+        spare.push_back(packet);
+    }
+
+    inline void queue_packet(DataPacket* packet) {
+        if (!decodeQueue.push(packet)) {
+            dlog("decodeQueue full, discard frame");
+            drops[DROP_QUEUE_FULL] ++;
+            recycle_packet(packet);
+        }
+    }
+
+    void push_ready_packet(DataPacket* packet) {
+        packet->keyframe = is_keyframe(packet);
+        queue_packet(packet);
     }
 
-    virtual void push_ready_packet(DataPacket*) = 0;
+    // True if decode_video() takes ownership of the packets passed to it and
+    // returns them with push_empty_packet() itself, once they are decoded.
+    virtual bool holds_packets(void) { return false; }
+
+    // True if every frame decodes on its own, so a newer one replaces it
+    virtual bool independent_frames(void) { return false; }
+
+    // Whether decoding can (re)start at this packet
+    virtual bool is_keyframe(DataPacket*) { return true; }
+
+    // Same, for a payload that is not in a DataPacket (yet). `data` may be
+    // the start of the payload only. No stats are kept.
+    virtual bool is_keyframe_data(const uint8_t*, size_t) { return true; }
+
+    // Decoders set the output timestamp themselves, since a frame may come out
+    // several packets after it went in. Passing a NULL packet returns the next
+    // frame the decoder already has ready, if any.
     virtual bool decode_video(struct obs_source_frame2*, DataPacket*, bool *got_output) = 0;
     virtual bool decode_audio(struct obs_source_audio*, DataPacket*, bool *got_output) = 0;
 };
@@ -1,5 +1,6 @@
 // Copyright (C) 2021 DEV47APPS, github.com/dev47apps
 #pragma once
+#include <mutex>
 #include <util/threading.h>
 
 #ifdef TEST
@@ -72,11 +73,14 @@ public:
 
 struct Proxy {
     DeviceDiscovery* discovery_mgr;
-    volatile Device *proxy_device;
     volatile socket_t proxy_sock;
 
-    int port_local;
+    // target of new connections: set by Start(), read by the proxy thread
+    std::mutex device_lock;
+    Device proxy_device;
     int port_remote;
+
+    int port_local;
     int thread_active;
 
     pthread_t pthr;
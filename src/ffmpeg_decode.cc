@@ -16,6 +16,9 @@
 	along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <time.h>
+#include <mutex>
+#include <util/platform.h>
 #include "plugin.h"
 #include "ffmpeg_decode.h"
 extern "C" {
@@ -71,24 +74,154 @@ static AVPixelFormat has_hw_type(const AVCodec *c, enum AVHWDeviceType type)
 	return AV_PIX_FMT_NONE;
 }
 
+// Hardware capability cache, shared by all sources and persisted across sessions.
+// Records per codec and device type ("h264.vaapi") the hw pixel format that
+// decoded a frame, or -1 if the device could not be created, the codec did not
+// open with it or frames could not be read back. Known-bad backends are not
+// probed again for HW_CACHE_RETRY_SEC (drivers and devices come and go).
+// Discarded when the FFmpeg version changes.
+// Device contexts are created once and shared by every decoder.
+#define HW_CACHE_FILE "hw_cache.json"
+#define HW_CACHE_RETRY_SEC (60 * 60 * 24)
+
+static std::mutex hw_cache_lock;
+static obs_data_t *hw_cache = NULL;
+static AVBufferRef *hw_shared_ctx[ARRAY_LEN(hw_device_list)];
+
+static void hw_cache_load(void)
+{
+	if (hw_cache)
+		return;
+
+	char *path = obs_module_config_path(HW_CACHE_FILE);
+	if (path) {
+		hw_cache = obs_data_create_from_json_file_safe(path, "bak");
+		bfree(path);
+	}
+
+	if (hw_cache && obs_data_get_int(hw_cache, "avcodec_version") != (long long) avcodec_version()) {
+		ilog("hw cache: FFmpeg version changed, probing devices again");
+		obs_data_release(hw_cache);
+		hw_cache = NULL;
+	}
+
+	if (!hw_cache) {
+		hw_cache = obs_data_create();
+		obs_data_set_int(hw_cache, "avcodec_version", avcodec_version());
+	}
+}
+
+static void hw_cache_save(void)
+{
+	char *dir = obs_module_config_path("");
+	char *path = obs_module_config_path(HW_CACHE_FILE);
+	if (dir && path) {
+		os_mkdirs(dir);
+		if (!obs_data_save_json_safe(hw_cache, path, "tmp", "bak"))
+			elog("hw cache: could not save %s", path);
+	}
+
+	bfree(dir);
+	bfree(path);
+}
+
+// Called with the lock held
+static void hw_cache_set(const char *key, int value)
+{
+	char failed_key[80];
+	snprintf(failed_key, sizeof(failed_key), "%s.failed_at", key);
+
+	obs_data_set_int(hw_cache, key, value);
+	if (value < 0)
+		obs_data_set_int(hw_cache, failed_key, (long long) time(NULL));
+	else
+		obs_data_erase(hw_cache, failed_key);
+}
+
+// Called with the lock held: whether `key` failed recently enough to skip
+static bool hw_cache_failed(const char *key)
+{
+	char failed_key[80];
+	snprintf(failed_key, sizeof(failed_key), "%s.failed_at", key);
+
+	if (!obs_data_has_user_value(hw_cache, key) || obs_data_get_int(hw_cache, key) >= 0)
+		return false;
+
+	const long long age = (long long) time(NULL) - obs_data_get_int(hw_cache, failed_key);
+	if (age >= 0 && age < HW_CACHE_RETRY_SEC)
+		return true;
+
+	ilog("hw %s failed %lld hours ago, trying again", key, age / 3600);
+	return false;
+}
+
+// Decoder outcome for the hw backend picked by init_hw_decoder()
+static void hw_cache_update(const char *key, int value)
+{
+	std::lock_guard<std::mutex> lock(hw_cache_lock);
+	if (!hw_cache)
+		return;
+
+	if (obs_data_has_user_value(hw_cache, key) && obs_data_get_int(hw_cache, key) == value)
+		return;
+
+	hw_cache_set(key, value);
+	hw_cache_save();
+}
+
+void ffmpeg_hw_cache_free(void)
+{
+	std::lock_guard<std::mutex> lock(hw_cache_lock);
+	for (size_t i = 0; i < ARRAY_LEN(hw_shared_ctx); i++) {
+		if (hw_shared_ctx[i])
+			av_buffer_unref(&hw_shared_ctx[i]);
+	}
+
+	if (hw_cache) {
+		obs_data_release(hw_cache);
+		hw_cache = NULL;
+	}
+}
+
 static void init_hw_decoder(FFMpegDecoder *d)
 {
-	enum AVHWDeviceType *hw_device_iter = hw_device_list;
 	AVBufferRef *hw_ctx = NULL;
+	bool changed = false;
+	char key[64];
+
+	std::lock_guard<std::mutex> lock(hw_cache_lock);
+	hw_cache_load();
+
+	for (size_t i = 0; hw_device_list[i] != AV_HWDEVICE_TYPE_NONE; i++) {
+		const enum AVHWDeviceType type = hw_device_list[i];
+		const enum AVPixelFormat pix_fmt = has_hw_type(d->codec, type);
+		dlog("trying hw %s => hw_pix_fmt=%d", av_hwdevice_get_type_name(type), pix_fmt);
+		if (pix_fmt == AV_PIX_FMT_NONE)
+			continue;
+
+		snprintf(key, sizeof(key), "%s.%s", d->codec->name, av_hwdevice_get_type_name(type));
+		if (hw_cache_failed(key)) {
+			dlog("skip hw %s: failed before", key);
+			continue;
+		}
 
-	while (*hw_device_iter != AV_HWDEVICE_TYPE_NONE) {
-		d->hw_pix_fmt = has_hw_type(d->codec, *hw_device_iter);
-		dlog("trying hw %s => hw_pix_fmt=%d", av_hwdevice_get_type_name(*hw_device_iter), d->hw_pix_fmt);
-		if (d->hw_pix_fmt != AV_PIX_FMT_NONE) {
-			if (av_hwdevice_ctx_create(&hw_ctx, *hw_device_iter, NULL, NULL, 0) == 0)
-				break;
-
-			d->hw_pix_fmt = AV_PIX_FMT_NONE;
+		if (!hw_shared_ctx[i] && av_hwdevice_ctx_create(&hw_shared_ctx[i], type, NULL, NULL, 0) != 0) {
+			hw_shared_ctx[i] = NULL;
+			hw_cache_set(key, -1);
+			changed = true;
+			continue;
 		}
 
-		hw_device_iter++;
+		// success is only recorded once a frame came out, see hw_cache_update()
+		hw_ctx = av_buffer_ref(hw_shared_ctx[i]);
+		d->hw_pix_fmt = pix_fmt;
+		snprintf(d->hw_key, sizeof(d->hw_key), "%s", key);
+		break;
 	}
 
+	if (changed)
+		hw_cache_save();
+
 	if (hw_ctx) {
 		d->decoder->hw_device_ctx = av_buffer_ref(hw_ctx);
 		d->hw_ctx = hw_ctx;
@@ -106,6 +239,7 @@ int FFMpegDecoder::init(uint8_t* header, enum AVCodecID id, bool use_hw)
 {
 	int ret;
 
+	codec_id = id;
 	codec = avcodec_find_decoder(id);
 	if (!codec)
 		return -1;
@@ -158,17 +292,21 @@ int FFMpegDecoder::init(uint8_t* header, enum AVCodecID id, bool use_hw)
 		init_hw_decoder(this);
 	}
 
-	ret = avcodec_open2(decoder, codec, NULL);
-	if (ret < 0) {
-		return ret;
-	}
-
 	// if (codec->capabilities & CODEC_CAP_TRUNC)
 	// 	decoder->flags |= CODEC_FLAG_TRUNC;
-	decoder->flags |= AV_CODEC_FLAG_LOW_DELAY;
 	decoder->flags2 |= AV_CODEC_FLAG2_FAST;
 	// decoder->flags2 |= AV_CODEC_FLAG2_CHUNKS;
-	decoder->thread_type = FF_THREAD_SLICE;
+	if (codec->type == AVMEDIA_TYPE_VIDEO)
+		setup_threading();
+	else
+		decoder->flags |= AV_CODEC_FLAG_LOW_DELAY;
+
+	ret = avcodec_open2(decoder, codec, NULL);
+	if (ret < 0) {
+		if (hw)
+			hw_cache_update(hw_key, -1);
+		return ret;
+	}
 
 	frame = av_frame_alloc();
 	if (!frame)
@@ -187,8 +325,89 @@ int FFMpegDecoder::init(uint8_t* header, enum AVCodecID id, bool use_hw)
 	return 0;
 }
 
+// Must run before avcodec_open2(), the codec ignores these afterwards.
+void FFMpegDecoder::setup_threading(void)
+{
+	static const char *names[] = {"auto", "slice", "frame"};
+	const int cores = os_get_logical_cores();
+	const int pixels = width_hint * height_hint;
+	enum DecodeThreading mode = threading;
+	int threads;
+
+	if (pixels <= 1280 * 720)
+		threads = 2;
+	else if (pixels <= 1920 * 1080)
+		threads = 4;
+	else
+		threads = 8;
+
+	// leave a core for OBS itself
+	if (threads > cores - 1) threads = cores - 1;
+	if (threads < 1) threads = 1;
+
+	if (mode == THREADING_AUTO) {
+		if (hw) {
+			// the GPU does the heavy lifting
+			mode = THREADING_SLICE;
+			threads = 1;
+		} else {
+			// only pay the frame-threading delay when one core can't keep up
+			mode = (pixels > 1920 * 1080) ? THREADING_FRAME : THREADING_SLICE;
+		}
+	}
+
+	decoder->thread_count = threads;
+	if (mode == THREADING_FRAME) {
+		decoder->thread_type = FF_THREAD_FRAME;
+	} else {
+		// LOW_DELAY turns off frame threading, so only set it here
+		decoder->thread_type = FF_THREAD_SLICE;
+		decoder->flags |= AV_CODEC_FLAG_LOW_DELAY;
+	}
+
+	ilog("video threading: %s (%s), %d threads, %d cores, %dx%d",
+		names[mode], names[threading], threads, cores, width_hint, height_hint);
+}
+
+void FFMpegDecoder::track_latency(int64_t pts)
+{
+	const uint64_t now = os_gettime_ns();
+	for (int i = 0; i < PTS_RING_SIZE; i++) {
+		if (pts_ring[i].ts && pts_ring[i].pts == pts) {
+			uint64_t latency = now - pts_ring[i].ts;
+			latency_total_ns += latency;
+			if (latency > latency_max_ns) latency_max_ns = latency;
+			latency_count ++;
+			pts_ring[i].ts = 0;
+			return;
+		}
+	}
+}
+
 FFMpegDecoder::~FFMpegDecoder(void)
 {
+	if (latency_count) {
+		ilog("~decoder decode latency: avg=%.2fms max=%.2fms (%llu frames, %d threads)",
+			(double) latency_total_ns / (double) latency_count / 1000000.0,
+			(double) latency_max_ns / 1000000.0,
+			(unsigned long long) latency_count,
+			decoder ? decoder->thread_count : 0);
+	}
+
+	if (scan_bytes) {
+		char types[256];
+		int len = 0;
+		for (int i = FRAME_TYPE_COUNT - 1; i >= 0 && len < (int) sizeof(types); i--) {
+			len += snprintf(&types[len], sizeof(types) - len, " %s=%llu",
+				frame_type_name((FrameType) i), (unsigned long long) frame_types[i]);
+		}
+		ilog("~decoder frame types:%s", types);
+
+		ilog("~decoder nal scan: %llu bytes, %.1f MB/s",
+			(unsigned long long) scan_bytes,
+			scan_ns ? (double) scan_bytes * 1000.0 / (double) scan_ns : 0.0);
+	}
+
 	if (frame_hw)
 		av_frame_free(&frame_hw);
 
@@ -317,87 +536,107 @@ static inline enum speaker_layout convert_speaker_layout(int channels)
 
 DataPacket* FFMpegDecoder::pull_empty_packet(size_t size)
 {
-	size_t new_size = size + AV_INPUT_BUFFER_PADDING_SIZE;
-	DataPacket* packet = Decoder::pull_empty_packet(new_size);
-	memset(packet->data, 0, new_size);
+	// FFmpeg only requires the padding past the end of the data to be zeroed
+	DataPacket* packet = Decoder::pull_empty_packet(size + AV_INPUT_BUFFER_PADDING_SIZE);
+	memset(packet->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+	zeroed_bytes += AV_INPUT_BUFFER_PADDING_SIZE;
 	return packet;
 }
 
-void FFMpegDecoder::push_ready_packet(DataPacket* packet)
+bool FFMpegDecoder::is_keyframe(DataPacket* packet)
 {
-	if (catchup) {
-		// Discard all incoming frames until the decoder has drained the queue
-		if (decodeQueue.items.size() > 1){
-			recieveQueue.add_item(packet);
-			return;
-		}
+	const bool hevc = codec_id == AV_CODEC_ID_H265;
+	if (!hevc && codec_id != AV_CODEC_ID_H264)
+		return true;
+
+	// Walk every NAL: the first one is often an AUD/SEI/parameter set
+	uint64_t start = os_gettime_ns();
+	packet->frame_type = nal_classify(packet->data, packet->used, hevc);
+	scan_ns += os_gettime_ns() - start;
+	scan_bytes += packet->used;
+	frame_types[packet->frame_type] ++;
+
+	// A packet without any slice NAL is not a resync point
+	return packet->frame_type >= FRAME_CRA;
+}
 
-		// Discard P/B frames and continue on anything higher
-		if (codec->id == AV_CODEC_ID_H264) {
-			int nalType = packet->data[2] == 1 ? (packet->data[3] & 0x1f) : (packet->data[4] & 0x1f);
-			if (nalType < 5) {
-				dlog("discard non-keyframe (AVC)");
-				recieveQueue.add_item(packet);
-				return;
-			}
-		}
-		else if (codec->id == AV_CODEC_ID_H265) {
-			int nalType = packet->data[2] == 1 ? ((packet->data[3] >> 1) & 0x3f) : ((packet->data[4] >> 1) & 0x3f);
-			if (nalType < 10) {
-				dlog("discard non-keyframe (HEVC)");
-				recieveQueue.add_item(packet);
-				return;
-			}
-		}
+bool FFMpegDecoder::is_keyframe_data(const uint8_t *data, size_t len)
+{
+	const bool hevc = codec_id == AV_CODEC_ID_H265;
+	if (!hevc && codec_id != AV_CODEC_ID_H264)
+		return true;
 
-		ilog("decoder catchup: decodeQueue: %ld recieveQueue: %ld", decodeQueue.items.size(), recieveQueue.items.size());
-		catchup = false;
-	}
+	return nal_classify(data, len, hevc) >= FRAME_CRA;
+}
 
-	decodeQueue.add_item(packet);
+void FFMpegDecoder::flush(void)
+{
+	if (decoder)
+		avcodec_flush_buffers(decoder);
 
-	// ((uint64_t)plugin->obs_audio_frame.frames * MILLI_SEC / (uint64_t)plugin->obs_audio_frame.samples_per_sec)
-	// At 44100HZ, 1 AAC Frame = 23ms
-	if (codec->id == AV_CODEC_ID_AAC && decodeQueue.items.size() > (1000/23)) {
-		catchup = true;
-	}
-	else if (decodeQueue.items.size() > 30) { // AVC, HEVC
-		catchup = true;
-	}
+	memset(pts_ring, 0, sizeof(pts_ring));
+	Decoder::flush();
 }
 
 bool FFMpegDecoder::decode_video(struct obs_source_frame2* obs_frame, DataPacket* data_packet,
 		bool *got_output)
 {
 	int ret;
-	AVFrame *out_frame;
+	AVFrame *out_frame = hw ? frame_hw : frame;
 	*got_output = false;
 
-	packet->data = data_packet->data;
-	packet->size = data_packet->used;
-	packet->pts = (data_packet->pts == NO_PTS) ? AV_NOPTS_VALUE : data_packet->pts;
+	if (data_packet) {
+		packet->data = data_packet->data;
+		packet->size = data_packet->used;
+		packet->pts = (data_packet->pts == NO_PTS) ? AV_NOPTS_VALUE : data_packet->pts;
 
-	if (decoder->has_b_frames && !b_frame_check) {
-		elog("WARNING Stream has b-frames!");
-		b_frame_check = true;
-	}
+		if (decoder->has_b_frames && !b_frame_check) {
+			elog("WARNING Stream has b-frames!");
+			b_frame_check = true;
+		}
 
-	ret = avcodec_send_packet(decoder, packet);
-	if (ret == 0) {
-		out_frame = hw ? frame_hw : frame;
-		ret = avcodec_receive_frame(decoder, out_frame);
-		if (ret == 0) goto GOT_FRAME;
+		ret = avcodec_send_packet(decoder, packet);
+		if (ret < 0)
+			return ret == AVERROR(EAGAIN);
+
+		if (packet->pts != AV_NOPTS_VALUE) {
+			pts_ring[pts_ring_pos].pts = packet->pts;
+			pts_ring[pts_ring_pos].ts = os_gettime_ns();
+			pts_ring_pos = (pts_ring_pos + 1) % PTS_RING_SIZE;
+		}
 	}
 
-	return ret == AVERROR(EAGAIN);
+	ret = avcodec_receive_frame(decoder, out_frame);
+	if (ret < 0)
+		return ret == AVERROR(EAGAIN);
+
+	if (out_frame->pts != AV_NOPTS_VALUE) {
+		track_latency(out_frame->pts);
+		frame_pts = out_frame->pts;
+		obs_frame->timestamp = out_frame->pts * 1000;
+	} else {
+		frame_pts = NO_PTS;
+		obs_frame->timestamp = os_gettime_ns();
+	}
 
-GOT_FRAME:
 	if (hw) {
 		if (frame_hw->format == hw_pix_fmt) {
+			// let the transfer allocate new planes after a resolution change
+			if (frame->width != frame_hw->width || frame->height != frame_hw->height)
+				av_frame_unref(frame);
+
 			if (av_hwframe_transfer_data(frame, frame_hw, 0) != 0
-					|| av_frame_copy_props(frame, frame_hw) != 0)
+					|| av_frame_copy_props(frame, frame_hw) != 0) {
+				if (!hw_confirmed)
+					hw_cache_update(hw_key, -1);
 				return false;
+			}
 			out_frame = frame;
+
+			if (!hw_confirmed) {
+				hw_confirmed = true;
+				hw_cache_update(hw_key, hw_pix_fmt);
+			}
 		}
 	}
 
@@ -406,12 +645,17 @@ GOT_FRAME:
 		obs_frame->linesize[i] = out_frame->linesize[i];
 	}
 
-	if (obs_frame->format == VIDEO_FORMAT_NONE) {
-		obs_frame->format = convert_pixel_format(out_frame->format);
+	// Checked on every frame: the stream can switch pixel format mid-way
+	const enum video_format format = convert_pixel_format(out_frame->format);
+	if (format != obs_frame->format) {
+		obs_frame->format = format;
 		ilog("format = %s", get_video_format_name(obs_frame->format));
 		if (obs_frame->format == VIDEO_FORMAT_NONE)
 			return false;
 
+		// color parameters depend on the format, recompute them below
+		obs_frame->range = VIDEO_RANGE_DEFAULT;
+
 		#if LIBOBS_API_MAJOR_VER >= 28
 		switch (out_frame->color_trc) {
 		case AVCOL_TRC_BT709:
@@ -43,7 +43,13 @@ extern "C" {
 
 #include "decoder.h"
 
+#define PTS_RING_SIZE 32
+
+// Release the shared hw device contexts, on module unload
+void ffmpeg_hw_cache_free(void);
+
 struct FFMpegDecoder : Decoder {
+	enum AVCodecID codec_id; // known before init(), for is_keyframe()
 	const AVCodec *codec;
 	AVCodecContext *decoder;
 	AVPacket *packet;
@@ -52,10 +58,27 @@ struct FFMpegDecoder : Decoder {
 	AVFrame *frame;
 	enum AVPixelFormat hw_pix_fmt;
 	bool hw;
-	bool catchup;
+	bool hw_confirmed; // a frame was decoded with hw
+	char hw_key[64];   // hw cache entry, see init_hw_decoder()
 	bool b_frame_check;
 
-	FFMpegDecoder(void) {
+	// send time per pts, to measure how long frames stay inside the decoder
+	struct {
+		int64_t pts;
+		uint64_t ts;
+	} pts_ring[PTS_RING_SIZE];
+	unsigned pts_ring_pos;
+	uint64_t latency_total_ns;
+	uint64_t latency_max_ns;
+	uint64_t latency_count;
+
+	uint64_t frame_types[FRAME_TYPE_COUNT];
+	uint64_t scan_bytes;
+	uint64_t scan_ns;
+
+	FFMpegDecoder(enum AVCodecID id = AV_CODEC_ID_NONE) {
+		codec_id = id;
+		codec = NULL;
 		decoder = NULL;
 		packet = NULL;
 		hw_ctx = NULL;
@@ -63,8 +86,17 @@ struct FFMpegDecoder : Decoder {
 		frame_hw = NULL;
 		hw_pix_fmt = AV_PIX_FMT_NONE;
 		hw = false;
-		catchup = false;
+		hw_confirmed = false;
+		hw_key[0] = 0;
 		b_frame_check = false;
+		memset(pts_ring, 0, sizeof(pts_ring));
+		pts_ring_pos = 0;
+		latency_total_ns = 0;
+		latency_max_ns = 0;
+		latency_count = 0;
+		memset(frame_types, 0, sizeof(frame_types));
+		scan_bytes = 0;
+		scan_ns = 0;
 	}
 
 	~FFMpegDecoder(void);
@@ -75,6 +107,12 @@ struct FFMpegDecoder : Decoder {
 	bool decode_audio(struct obs_source_audio*, DataPacket*, bool *got_output);
 
 	DataPacket* pull_empty_packet(size_t size);
-	void push_ready_packet(DataPacket*);
+	bool is_keyframe(DataPacket*);
+	bool is_keyframe_data(const uint8_t *data, size_t len);
+	void flush(void);
+
+private:
+	void setup_threading(void);
+	void track_latency(int64_t pts);
 };
 #endif
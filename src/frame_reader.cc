@@ -0,0 +1,310 @@
+/*
+Copyright (C) 2025 DEV47APPS, github.com/dev47apps
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <errno.h>
+#include <string.h>
+#include <util/platform.h>
+#include "plugin.h"
+#include "frame_reader.h"
+#include "buffer_util.h"
+
+FrameReader::FrameReader(size_t buf_size) {
+    buf = (uint8_t*) bmalloc(buf_size);
+    size = buf_size;
+    sock = INVALID_SOCKET;
+    recv_bytes = 0;
+    total_bytes = 0;
+    reset(INVALID_SOCKET);
+}
+
+FrameReader::~FrameReader(void) {
+    bfree(buf);
+}
+
+void FrameReader::reset(socket_t new_sock, bool nonblock) {
+    sock = new_sock;
+    nonblocking = nonblock;
+    waiting = false;
+    head = tail = 0;
+    start_ts = os_gettime_ns();
+    total_bytes += recv_bytes;
+    recv_calls = 0;
+    recv_bytes = 0;
+    frames = 0;
+    rate_pts = 0;
+    rate_bytes = 0;
+    bytes_per_ms = 0;
+    backlog_check_pts = 0;
+    skipping = false;
+    skipped_frames = 0;
+    skipped_bytes = 0;
+}
+
+void FrameReader::log_stats(const char *name) {
+    if (frames == 0)
+        return;
+
+    const double seconds = (double) (os_gettime_ns() - start_ts) / 1000000000.0;
+    ilog("%s: %llu frames, %llu bytes (%.0f kbps over %.1fs), %llu recv calls (%.2f per frame)", name,
+        (unsigned long long) frames,
+        (unsigned long long) recv_bytes,
+        seconds > 0 ? (double) recv_bytes * 8 / 1000.0 / seconds : 0.0,
+        seconds,
+        (unsigned long long) recv_calls,
+        (double) recv_calls / (double) frames);
+
+    if (skipped_frames)
+    ilog("%s: skipped %llu frames (%llu KB) of socket backlog", name,
+        (unsigned long long) skipped_frames,
+        (unsigned long long) skipped_bytes / 1024);
+}
+
+bool FrameReader::fill(size_t len) {
+    if (nonblocking) {
+        // frame_ready() guarantees the data, so this is a parser bug
+        elog("fill: %lu bytes not buffered in non-blocking mode", (unsigned long) len);
+        return false;
+    }
+
+    if (head + len > size) {
+        // compact: move the partial frame to the front
+        size_t have = tail - head;
+        memmove(buf, &buf[head], have);
+        head = 0;
+        tail = have;
+    }
+
+    while (tail - head < len) {
+        ssize_t r = net_recv(sock, &buf[tail], size - tail);
+        recv_calls++;
+        if (r <= 0) {
+            WSAErrno();
+            elog("recv failed/timeout (%ld): have %lu wanted %lu", (long) r,
+                (unsigned long) (tail - head), (unsigned long) len);
+            return false;
+        }
+        tail += r;
+        recv_bytes += r;
+    }
+
+    return true;
+}
+
+const uint8_t* FrameReader::peek(size_t len) {
+    if (len > size)
+        return NULL;
+
+    if (tail - head < len && !fill(len))
+        return NULL;
+
+    return &buf[head];
+}
+
+bool FrameReader::read(uint8_t *dst, size_t len) {
+    size_t have = tail - head;
+    if (have >= len) {
+        memcpy(dst, &buf[head], len);
+        consume(len);
+        return true;
+    }
+
+    memcpy(dst, &buf[head], have);
+    consume(have);
+    dst += have;
+    len -= have;
+
+    // Small remainder: refill the buffer, which also picks up the next frame(s).
+    if (len <= size / 2) {
+        if (!fill(len))
+            return false;
+
+        memcpy(dst, &buf[head], len);
+        consume(len);
+        return true;
+    }
+
+    // Large remainder: skip the extra copy and read straight into place.
+    ssize_t r = net_recv_all(sock, dst, len);
+    recv_calls++;
+    if (r != (ssize_t) len) {
+        elog("read_frame: timeout/error: read %ld bytes wanted %lu", (long) r, (unsigned long) len);
+        return false;
+    }
+
+    recv_bytes += r;
+    return true;
+}
+
+bool FrameReader::read_header(uint64_t *pts, uint32_t *len) {
+    const uint8_t *header = peek(HEADER_SIZE);
+    if (!header)
+        return false;
+
+    *pts = buffer_read64be(header);
+    *len = buffer_read32be(&header[8]);
+    consume(HEADER_SIZE);
+    return true;
+}
+
+bool FrameReader::skip(size_t len) {
+    size_t have = tail - head;
+    if (have >= len) {
+        consume(len);
+        return true;
+    }
+
+    consume(have);
+    len -= have;
+
+    // The buffer is empty now; receive into it and keep whatever
+    // belongs to the next frame(s).
+    while (len) {
+        ssize_t r = net_recv(sock, buf, size);
+        recv_calls++;
+        if (r <= 0) {
+            WSAErrno();
+            elog("skip: recv failed/timeout (%ld): wanted %lu", (long) r, (unsigned long) len);
+            return false;
+        }
+
+        recv_bytes += r;
+        if ((size_t) r > len) {
+            head = len;
+            tail = r;
+            break;
+        }
+        len -= r;
+    }
+
+    return true;
+}
+
+void FrameReader::track_rate(uint64_t pts, size_t len) {
+    if (rate_pts == 0 || pts < rate_pts) {
+        rate_pts = pts;
+        rate_bytes = 0;
+        return;
+    }
+
+    rate_bytes += len + HEADER_SIZE;
+    const uint64_t span = pts - rate_pts;
+    if (span >= 1000000) {
+        const double rate = (double) rate_bytes / ((double) span / 1000.0);
+        bytes_per_ms = (bytes_per_ms == 0) ? rate : bytes_per_ms + (rate - bytes_per_ms) / 4.0;
+        rate_pts = pts;
+        rate_bytes = 0;
+    }
+}
+
+uint32_t FrameReader::backlog_ms(void) {
+    if (bytes_per_ms <= 0)
+        return 0;
+
+    ssize_t pending = net_recv_pending(sock);
+    if (pending < 0)
+        pending = 0;
+
+    return (uint32_t) ((double) (buffered() + pending) / bytes_per_ms);
+}
+
+// Make room for `len` unparsed bytes: compact, then grow if still short.
+bool FrameReader::grow(size_t len) {
+    if (head > 0 && head + len > size) {
+        size_t have = tail - head;
+        memmove(buf, &buf[head], have);
+        head = 0;
+        tail = have;
+    }
+
+    if (len <= size)
+        return true;
+
+    if (len > READER_MAX_FRAME + 2 * HEADER_SIZE)
+        return false;
+
+    buf = (uint8_t*) brealloc(buf, len);
+    size = len;
+    return true;
+}
+
+bool FrameReader::drain(void) {
+    while (1) {
+        if (tail == size) {
+            if (head == 0)
+                return true; // full: parse before reading more
+
+            grow(size - head + 1);
+        }
+
+        ssize_t r = net_recv(sock, &buf[tail], size - tail);
+        recv_calls++;
+        if (r > 0) {
+            tail += r;
+            recv_bytes += r;
+            continue;
+        }
+
+        if (r < 0) {
+            WSAErrno();
+            #ifdef _WIN32
+            if (errno == WSAEWOULDBLOCK)
+            #else
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            #endif
+                return true;
+        }
+
+        elog("recv failed/closed (%ld): %s", (long) r, r < 0 ? strerror(errno) : "eof");
+        return false;
+    }
+}
+
+bool FrameReader::frame_ready(void) {
+    size_t need = HEADER_SIZE;
+    if (tail - head < need)
+        goto WAIT;
+
+    {
+        const uint64_t pts = buffer_read64be(&buf[head]);
+        uint32_t len = buffer_read32be(&buf[head + 8]);
+        if (len == (uint32_t) NO_PTS || len == 0 || len > READER_MAX_FRAME)
+            return true;
+
+        need += len;
+        if (pts == NO_PTS) {
+            // config goes with the frame after it
+            need += HEADER_SIZE;
+            if (tail - head < need)
+                goto WAIT;
+
+            len = buffer_read32be(&buf[head + need - 4]);
+            if (len == (uint32_t) NO_PTS || len == 0 || len > READER_MAX_FRAME)
+                return true;
+
+            need += len;
+        }
+    }
+
+    if (tail - head >= need)
+        return true;
+
+    WAIT:
+    if (!grow(need)) {
+        elog("frame_ready: %lu byte frame does not fit", (unsigned long) need);
+        return true; // let the parser fail on it
+    }
+    return false;
+}
@@ -0,0 +1,92 @@
+// Copyright (C) 2025 DEV47APPS, github.com/dev47apps
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "net.h"
+
+#define VIDEO_READER_SIZE (1024 * 512)
+#define AUDIO_READER_SIZE (1024 * 32)
+#define READER_MAX_FRAME (1024 * 1024 * 16 + 1024) // payload + config
+
+// Buffered reader for the [pts:8][len:4][payload] framing used by the app.
+// Bytes are drained from the socket with large recv() calls into a single
+// buffer, and headers/payloads are parsed out of it in place. Data is only
+// moved (compacted to the front) when a frame would run past the end.
+// Payloads that are too big to be worth buffering are read directly into
+// the destination after the buffered prefix is copied.
+//
+// In non-blocking mode (sockets driven by the reactor) nothing is received
+// while parsing: drain() pulls in whatever the socket has, and frames are
+// only parsed once frame_ready() says all their bytes are buffered. The
+// buffer grows to fit the largest frame seen.
+struct FrameReader {
+    uint8_t *buf;
+    size_t size;
+    size_t head; // next byte to parse
+    size_t tail; // end of received data
+    socket_t sock;
+    bool nonblocking;
+    bool waiting; // non-blocking mode: parsing stopped for lack of data
+
+    uint64_t recv_calls;
+    uint64_t recv_bytes;
+    uint64_t frames;
+    uint64_t start_ts;
+    uint64_t total_bytes; // across connections
+
+    // Catch-up after a stall: unread bytes (buffered here and in the kernel)
+    // are converted to ms of media using the byte rate seen over ~1s of pts.
+    uint64_t rate_pts;
+    uint64_t rate_bytes;
+    double bytes_per_ms;
+    uint64_t backlog_check_pts;
+    bool skipping;
+    uint64_t skipped_frames;
+    uint64_t skipped_bytes;
+
+    FrameReader(size_t buf_size);
+    ~FrameReader(void);
+
+    void reset(socket_t new_sock, bool nonblock = false);
+    void log_stats(const char *name);
+
+    // Returns a contiguous view of the next `len` bytes, valid until the next call.
+    // Returns NULL on socket error/timeout, or if len exceeds the buffer size.
+    const uint8_t* peek(size_t len);
+
+    inline void consume(size_t len) {
+        head += len;
+        if (head == tail) head = tail = 0;
+    }
+
+    inline size_t buffered(void) {
+        return tail - head;
+    }
+
+    // Copy the next `len` bytes into dst.
+    bool read(uint8_t *dst, size_t len);
+
+    bool read_header(uint64_t *pts, uint32_t *len);
+
+    // Discard the next `len` bytes without copying them out
+    bool skip(size_t len);
+
+    void track_rate(uint64_t pts, size_t len);
+
+    // Estimated media waiting to be read, 0 until the byte rate is known
+    uint32_t backlog_ms(void);
+
+    // Non-blocking mode: receive everything the socket has ready.
+    // Returns false when the connection closed or failed.
+    bool drain(void);
+
+    // Non-blocking mode: whether the next frame (and the config packet in
+    // front of it, if any) is fully buffered. Malformed headers count as
+    // ready, for the parser to reject.
+    bool frame_ready(void);
+
+private:
+    bool grow(size_t len);
+    bool fill(size_t len);
+};
@@ -0,0 +1,189 @@
+/*
+Copyright (C) 2025 DEV47APPS, github.com/dev47apps
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/platform.h>
+#include "plugin.h"
+#include "http_client.h"
+
+HttpClient::HttpClient(void) {
+    requests = 0;
+    connections = 0;
+    reset(INVALID_SOCKET);
+}
+
+void HttpClient::reset(socket_t new_sock) {
+    sock = new_sock;
+    len = 0;
+    keep_alive = true;
+    stale = false;
+    responses = 0;
+    rtt_ns = 0;
+    if (sock != INVALID_SOCKET)
+        connections ++;
+}
+
+bool HttpClient::fill(void) {
+    if (len >= sizeof(buf) - 1) {
+        elog("http: response too large");
+        errno = EINVAL;
+        return false;
+    }
+
+    int rc = net_recv(sock, &buf[len], sizeof(buf) - 1 - len);
+    if (rc > 0) {
+        len += rc;
+        return true;
+    }
+
+    if (rc == 0) {
+        errno = 0;
+        return false;
+    }
+
+    WSAErrno();
+    return false;
+}
+
+// Case-insensitive match of header `name` at the start of `line`, returns its value
+static const char *header_value(const char *line, const char *name) {
+    size_t i = 0;
+    for (; name[i]; i++) {
+        if (tolower((unsigned char) line[i]) != name[i])
+            return NULL;
+    }
+
+    if (line[i] != ':')
+        return NULL;
+
+    i++;
+    while (line[i] == ' ' || line[i] == '\t')
+        i++;
+
+    return &line[i];
+}
+
+static bool token_equals(const char *value, const char *token) {
+    size_t i = 0;
+    for (; token[i]; i++) {
+        if (tolower((unsigned char) value[i]) != token[i])
+            return false;
+    }
+    return value[i] == '\r' || value[i] == ' ' || value[i] == ',' || value[i] == ';';
+}
+
+bool HttpClient::request(const char *request, size_t request_len, HttpResponse *res) {
+    const bool reused = responses > 0;
+    const uint64_t start = os_gettime_ns();
+    char *end = NULL;
+    stale = false;
+    len = 0;
+
+    if (sock == INVALID_SOCKET || !keep_alive) {
+        errno = 0;
+        return false;
+    }
+
+    requests ++;
+    if (net_send_all(sock, request, request_len) <= 0) {
+        WSAErrno();
+        stale = reused;
+        return false;
+    }
+
+    // Status line and headers
+    size_t scan = 0;
+    while (1) {
+        buf[len] = 0;
+        if ((end = strstr(&buf[scan], "\r\n\r\n")) != NULL)
+            break;
+
+        scan = len > 3 ? len - 3 : 0;
+        if (!fill()) {
+            stale = reused && len == 0 && errno == 0;
+            return false;
+        }
+    }
+
+    const size_t header_len = (end - buf) + 4;
+    int major = 0, minor = 0, status = 0;
+    if (sscanf(buf, "HTTP/%d.%d %d", &major, &minor, &status) != 3) {
+        elog("http: bad status line");
+        keep_alive = false;
+        errno = EINVAL;
+        return false;
+    }
+
+    long long content_length = -1;
+    keep_alive = (major > 1 || minor > 0);
+    for (char *line = strstr(buf, "\r\n") + 2; line < end; line = strstr(line, "\r\n") + 2) {
+        const char *value;
+        if ((value = header_value(line, "content-length")) != NULL) {
+            content_length = strtoll(value, NULL, 10);
+        }
+        else if ((value = header_value(line, "connection")) != NULL) {
+            if (token_equals(value, "close"))
+                keep_alive = false;
+            else if (token_equals(value, "keep-alive"))
+                keep_alive = true;
+        }
+        else if ((value = header_value(line, "transfer-encoding")) != NULL) {
+            if (!token_equals(value, "identity"))
+                content_length = -1; // not expected from the app, read to close
+        }
+    }
+
+    // Body
+    if ((status >= 100 && status < 200) || status == 204 || status == 304)
+        content_length = 0;
+
+    if (content_length >= 0) {
+        if (header_len + content_length > sizeof(buf) - 1) {
+            elog("http: response too large (%lld bytes)", content_length);
+            keep_alive = false;
+            errno = EINVAL;
+            return false;
+        }
+
+        while (len < header_len + content_length) {
+            if (!fill()) {
+                keep_alive = false;
+                return false;
+            }
+        }
+    }
+    else {
+        keep_alive = false;
+        while (fill());
+        content_length = len - header_len;
+    }
+
+    if (len > header_len + content_length)
+        dlog("http: dropping %d unexpected bytes", (int) (len - header_len - content_length));
+
+    buf[header_len + content_length] = 0;
+    res->status = status;
+    res->body = &buf[header_len];
+    res->body_len = (size_t) content_length;
+
+    responses ++;
+    rtt_ns = os_gettime_ns() - start;
+    return true;
+}
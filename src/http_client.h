@@ -0,0 +1,46 @@
+// Copyright (C) 2025 DEV47APPS, github.com/dev47apps
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "net.h"
+
+#define HTTP_CLIENT_SIZE 4096
+
+struct HttpResponse {
+    int status;
+    const char *body; // NUL terminated, valid until the next request
+    size_t body_len;
+};
+
+// Minimal HTTP/1.1 client for the small request/response exchanges on the
+// comms connection (tally, battery).
+//
+// The response is parsed as it arrives: status line, then headers for
+// Content-Length / Connection, then exactly that many body bytes. A request
+// completes as soon as its response does, instead of reading until the
+// socket timeout, and the connection is kept open for the next one.
+// Responses without a length are read until the app closes the connection.
+struct HttpClient {
+    char buf[HTTP_CLIENT_SIZE];
+    size_t len; // received bytes in buf
+    socket_t sock;
+    bool keep_alive; // the connection can take another request
+    bool stale;      // last request found a reused connection closed by the app
+    uint32_t responses; // on this connection
+    uint64_t rtt_ns;    // of the last request
+
+    uint64_t requests;
+    uint64_t connections;
+
+    HttpClient(void);
+
+    void reset(socket_t new_sock);
+
+    // Send `request` and read its response into `res`.
+    // Returns false on error/timeout; errno is 0 when the app closed the connection.
+    bool request(const char *request, size_t request_len, HttpResponse *res);
+
+private:
+    bool fill(void);
+};
@@ -238,6 +238,7 @@ void MDNS::DoReload(void) {
     void* buffer = malloc(capacity * PARALLEL);
 
     struct sockaddr* saddr = NULL;
+    struct sockaddr_storage bind_ss;
 
     struct query {
         socket_t sock;
@@ -250,7 +251,8 @@ void MDNS::DoReload(void) {
 
     if (bindIP && bindIP[0]) {
         dlog("mDNS: bindIP=%s", bindIP);
-        saddr = net_sock_addr(bindIP);
+        if (net_sock_addr(bindIP, &bind_ss))
+            saddr = (struct sockaddr*) &bind_ss;
     }
 
     for (int i = 0; i < PARALLEL; i++) {
@@ -14,6 +14,8 @@ GNU General Public License for more details.
 You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <string.h>
+#include <util/platform.h>
 #include "plugin.h"
 #include "mjpeg_decode.h"
 
@@ -21,7 +23,9 @@ extern "C" {
     FILE __iob_func[3] = { *stdin,*stdout,*stderr };
 }
 
-MJpegDecoder::~MJpegDecoder(void) {
+MJpegContext::~MJpegContext(void) {
+    delete stripes;
+
     if (frameBuf)
         bfree(frameBuf);
 
@@ -29,92 +33,673 @@ MJpegDecoder::~MJpegDecoder(void) {
         tjDestroy(tj);
 }
 
-bool MJpegDecoder::init(void) {
-    if (tj) {
-        elog("tj != NULL on init");
-        return false;
+// Point the output planes at frameBuf for the given stream layout,
+// growing the buffer if needed.
+bool MJpegContext::setup_frame(struct obs_source_frame2* obs_frame, int width, int height, int subsamp)
+{
+    enum video_format format;
+    switch (subsamp) {
+        case TJSAMP_420:
+            format = VIDEO_FORMAT_I420;
+            break;
+        #if LIBOBS_API_MAJOR_VER >= 28
+        case TJSAMP_422:
+            format = VIDEO_FORMAT_I422;
+            break;
+        #endif
+        case TJSAMP_444:
+            format = VIDEO_FORMAT_I444;
+            break;
+        default:
+            elog("error: unexpected video image stream subsampling: %d\n", subsamp);
+            return false;
     }
 
-    tj = tjInitDecompress();
-    if (!tj) {
-        elog("error creating mjpeg decoder: %s", tjGetErrorStr2(NULL));
-        return false;
+    size_t offsets[3];
+    size_t total = 0;
+    for (int i = 0; i < 3; i++) {
+        int plane_w = tjPlaneWidth(i, width, subsamp);
+        int plane_h = tjPlaneHeight(i, height, subsamp);
+        if (plane_w <= 0 || plane_h <= 0)
+            return false;
+
+        obs_frame->linesize[i] = plane_w;
+        offsets[i] = total;
+        total += (size_t) plane_w * plane_h;
     }
 
-    ready = true;
+    if (total > frameBufSize) {
+        frameBuf = (uint8_t*) brealloc(frameBuf, total);
+        frameBufSize = total;
+    }
+
+    for (int i = 0; i < 3; i++)
+        obs_frame->data[i] = frameBuf + offsets[i];
+
+    obs_frame->data[3] = NULL;
+    obs_frame->linesize[3] = 0;
+    obs_frame->width = width;
+    obs_frame->height = height;
+    obs_frame->format = format;
+
+    ilog("mjpeg output is %dx%d subsamp %d\n", width, height, subsamp);
+    mWidth = width;
+    mHeight = height;
+    mSubsamp = subsamp;
     return true;
 }
 
-void MJpegDecoder::push_ready_packet(DataPacket* packet) {
-    if (decodeQueue.items.size() > 1) {
-        dlog("discard frame");
-        recieveQueue.add_item(packet);
-    } else {
-        decodeQueue.add_item(packet);
+// Smallest of the 1/2, 1/4, 1/8 turbojpeg scales that still covers the display size
+static void display_scale(int width, int height, int display_w, int display_h, int *out_w, int *out_h) {
+    *out_w = width;
+    *out_h = height;
+    if (display_w <= 0 && display_h <= 0)
+        return;
+
+    for (int denom = 2; denom <= 8; denom *= 2) {
+        const tjscalingfactor sf = {1, denom};
+        const int w = TJSCALED(width, sf);
+        const int h = TJSCALED(height, sf);
+        if (w < display_w || h < display_h)
+            break;
+
+        *out_w = w;
+        *out_h = h;
     }
 }
 
-bool MJpegDecoder::decode_video(struct obs_source_frame2* obs_frame, DataPacket* data_packet,
-        bool *got_output)
+bool MJpegContext::decode(struct obs_source_frame2* obs_frame, DataPacket* data_packet)
 {
-    *got_output = false;
-    if (mSubsamp == 0) {
-        int width, height, subsamp, colorspace;
-        if (tjDecompressHeader3(tj,
+    // Header parsing is cheap, check every frame for rotation/resolution changes
+    int width, height, subsamp, colorspace;
+    if (tjDecompressHeader3(tj,
+        data_packet->data, data_packet->used,
+        &width, &height, &subsamp, &colorspace) < 0)
+    {
+        elog("tjDecompressHeader3() failure: %d\n", tjGetErrorCode(tj));
+        elog("%s\n", tjGetErrorStr2(tj));
+        return false;
+    }
+
+    display_scale(width, height, display_width, display_height, &width, &height);
+    if (width != mWidth || height != mHeight || subsamp != mSubsamp
+        || obs_frame->data[0] != frameBuf)
+    {
+        if (!setup_frame(obs_frame, width, height, subsamp))
+            return false;
+    }
+
+    if (obs_frame->range != VIDEO_RANGE_FULL) {
+        video_format_get_parameters(
+            VIDEO_CS_DEFAULT, VIDEO_RANGE_FULL, obs_frame->color_matrix,
+            obs_frame->color_range_min, obs_frame->color_range_max);
+        obs_frame->range = VIDEO_RANGE_FULL;
+    }
+
+    const uint64_t start = os_gettime_ns();
+    bool ok;
+
+    // Debug builds decode every 64th frame whole, as a reference for the stats.
+    // Release builds only decode whole what the stripes can't handle.
+    #ifdef DEBUG
+    const bool reference = (whole_frames + striped_frames) % 64 == 0;
+    #else
+    const bool reference = false;
+    #endif
+    if (stripes && !reference
+        && stripes->decode(data_packet->data, data_packet->used, obs_frame, subsamp, &ok))
+    {
+        if (!ok) {
+            elog("mjpeg stripe decode failure");
+            return false;
+        }
+
+        striped_ns += os_gettime_ns() - start;
+        striped_frames ++;
+    }
+    else {
+        if (tjDecompressToYUVPlanes(tj,
             data_packet->data, data_packet->used,
-            &width, &height, &subsamp, &colorspace) < 0)
+            obs_frame->data, obs_frame->width,
+            (int*)obs_frame->linesize, obs_frame->height,
+            TJFLAG_FASTDCT | TJFLAG_FASTUPSAMPLE))
         {
-            elog("tjDecompressHeader3() failure: %d\n", tjGetErrorCode(tj));
-            elog("%s\n", tjGetErrorStr2(tj));
+            elog("tjDecompressToYUV2 failure: %d\n", tjGetErrorCode(tj));
             return false;
         }
 
-        ilog("mjpeg stream is %dx%d subsamp %d colorspace %d\n", width, height, subsamp, colorspace);
-        if (subsamp != TJSAMP_420) {
-            elog("error: unexpected video image stream subsampling: %d\n", subsamp);
+        whole_ns += os_gettime_ns() - start;
+        whole_frames ++;
+    }
+
+    obs_frame->timestamp = data_packet->pts * 1000;
+    obs_frame->flip = false;
+    return true;
+}
+
+// Restart layout of a baseline JPEG
+struct JpegRestarts {
+    size_t sof_height; // offset of the SOF height field
+    size_t scan;       // first byte of entropy-coded data
+    size_t end;        // EOI marker, or end of data
+    int interval;      // MCUs per restart interval
+    int mcu_w, mcu_h;
+    int width, height;
+    int count;         // RSTn markers found
+    uint32_t marker[MJPEG_MAX_RESTARTS];
+};
+
+static bool jpeg_find_restarts(const uint8_t *p, size_t len, JpegRestarts *r) {
+    int components = 0;
+    r->interval = 0;
+    r->sof_height = 0;
+    r->scan = 0;
+
+    if (len < 4 || p[0] != 0xFF || p[1] != 0xD8)
+        return false;
+
+    size_t i = 2;
+    while (r->scan == 0) {
+        if (i + 4 > len || p[i] != 0xFF)
             return false;
+
+        const uint8_t m = p[i + 1];
+        if (m == 0xFF) { // fill byte
+            i++;
+            continue;
         }
 
-        int ySize  = width * height;
-        int uvSize = ySize / 4;
+        const size_t seg = (p[i + 2] << 8) | p[i + 3];
+        const uint8_t *d = &p[i + 4];
+        if (seg < 2 || i + 2 + seg > len)
+            return false;
+
+        if (m >= 0xC0 && m <= 0xCF && m != 0xC4 && m != 0xC8 && m != 0xCC) {
+            // only sequential Huffman (baseline/extended) has a single scan
+            if (m != 0xC0 && m != 0xC1)
+                return false;
+
+            if (seg < 8)
+                return false;
 
-        size_t Yuv420Size = ySize * 3 / 2;
-        frameBuf = (uint8_t*) brealloc(frameBuf, Yuv420Size);
+            components = d[5];
+            if (seg < 8 + 3 * (size_t) components)
+                return false;
+
+            r->sof_height = i + 5;
+            r->height = (d[1] << 8) | d[2];
+            r->width  = (d[3] << 8) | d[4];
+
+            int hmax = 1, vmax = 1;
+            for (int c = 0; c < components; c++) {
+                const int hv = d[6 + c * 3 + 1];
+                if ((hv >> 4) > hmax) hmax = hv >> 4;
+                if ((hv & 15) > vmax) vmax = hv & 15;
+            }
+            r->mcu_w = 8 * hmax;
+            r->mcu_h = 8 * vmax;
+        }
+        else if (m == 0xDD) { // DRI
+            if (seg < 4)
+                return false;
 
-        obs_frame->linesize[0] = width;
-        obs_frame->linesize[1] = width>>1;
-        obs_frame->linesize[2] = width>>1;
-        obs_frame->linesize[3] = 0;
+            r->interval = (d[0] << 8) | d[1];
+        }
+        else if (m == 0xDA) { // SOS: all components must be in this one scan
+            if (components == 0 || d[0] != components)
+                return false;
 
-        obs_frame->data[0] = frameBuf;
-        obs_frame->data[1] = obs_frame->data[0] + ySize;
-        obs_frame->data[2] = obs_frame->data[1] + uvSize;
-        obs_frame->data[3] = NULL;
+            r->scan = i + 2 + seg;
+        }
 
-        obs_frame->width = width;
-        obs_frame->height = height;
-        obs_frame->format = VIDEO_FORMAT_I420;
-        mSubsamp = subsamp;
+        i += 2 + seg;
     }
 
-    if (obs_frame->range != VIDEO_RANGE_FULL) {
-        video_format_get_parameters(
-            VIDEO_CS_DEFAULT, VIDEO_RANGE_FULL, obs_frame->color_matrix,
-            obs_frame->color_range_min, obs_frame->color_range_max);
-        obs_frame->range = VIDEO_RANGE_FULL;
+    if (r->interval == 0 || r->sof_height == 0)
+        return false;
+
+    r->count = 0;
+    r->end = len;
+    const uint8_t *q = p + r->scan;
+    const uint8_t *e = p + len;
+    while (q + 1 < e) {
+        q = (const uint8_t*) memchr(q, 0xFF, e - q - 1);
+        if (!q)
+            break;
+
+        const uint8_t m = q[1];
+        if (m >= 0xD0 && m <= 0xD7) {
+            if (r->count == MJPEG_MAX_RESTARTS)
+                return false;
+
+            r->marker[r->count++] = (uint32_t) (q - p);
+            q += 2;
+        }
+        else if (m == 0xD9) {
+            r->end = q - p;
+            break;
+        }
+        else {
+            // 0xFF00 is a stuffed data byte, 0xFFFF is fill
+            q += (m == 0xFF) ? 1 : 2;
+        }
     }
 
-    if (tjDecompressToYUVPlanes(tj,
-        data_packet->data, data_packet->used,
-        obs_frame->data, obs_frame->width,
-        (int*)obs_frame->linesize, obs_frame->height,
-        TJFLAG_FASTDCT | TJFLAG_FASTUPSAMPLE))
+    return r->count > 0;
+}
+
+static void *mjpeg_stripe_thread(void *data) {
+    MJpegStripe *stripe = (MJpegStripe*) data;
+    MJpegStripes *pool = stripe->pool;
+    os_set_thread_name("droidcam-mjpeg-stripe");
+
+    while (true) {
+        os_event_wait(stripe->start);
+        if (pool->stopping)
+            break;
+
+        stripe->ok = tjDecompressToYUVPlanes(stripe->tj,
+            stripe->jpeg, stripe->jpeg_len,
+            stripe->planes, stripe->width, stripe->strides, stripe->height,
+            TJFLAG_FASTDCT | TJFLAG_FASTUPSAMPLE) == 0;
+
+        if (--pool->pending == 0)
+            os_event_signal(pool->done);
+    }
+
+    return NULL;
+}
+
+MJpegStripes::~MJpegStripes(void) {
+    stopping = true;
+    for (int i = 0; i < count; i++) {
+        MJpegStripe *stripe = &stripes[i];
+        if (stripe->running) {
+            os_event_signal(stripe->start);
+            pthread_join(stripe->thread, NULL);
+        }
+
+        if (stripe->start)
+            os_event_destroy(stripe->start);
+
+        if (stripe->tj)
+            tjDestroy(stripe->tj);
+
+        bfree(stripe->jpeg);
+    }
+
+    if (done)
+        os_event_destroy(done);
+}
+
+bool MJpegStripes::init(int stripe_count) {
+    if (os_event_init(&done, OS_EVENT_TYPE_AUTO) != 0)
+        return false;
+
+    for (int i = 0; i < stripe_count; i++) {
+        MJpegStripe *stripe = &stripes[i];
+        memset(stripe, 0, sizeof(*stripe));
+        stripe->pool = this;
+        count = i + 1;
+
+        stripe->tj = tjInitDecompress();
+        if (!stripe->tj)
+            return false;
+
+        // the last stripe runs on the caller's thread
+        if (i == stripe_count - 1)
+            break;
+
+        if (os_event_init(&stripe->start, OS_EVENT_TYPE_AUTO) != 0
+            || pthread_create(&stripe->thread, NULL, mjpeg_stripe_thread, stripe) != 0)
+            return false;
+
+        stripe->running = true;
+    }
+
+    return true;
+}
+
+bool MJpegStripes::decode(const uint8_t *data, size_t len, struct obs_source_frame2* obs_frame,
+    int subsamp, bool *ok)
+{
+    static thread_local JpegRestarts r;
+    *ok = false;
+
+    if (!jpeg_find_restarts(data, len, &r))
+        return false;
+
+    // Stripes must be whole MCU rows
+    const int mcus_per_row = (r.width + r.mcu_w - 1) / r.mcu_w;
+    const int mcu_rows = (r.height + r.mcu_h - 1) / r.mcu_h;
+    if (r.interval % mcus_per_row != 0)
+        return false;
+
+    const int rows_per_segment = r.interval / mcus_per_row;
+    const int segments = r.count + 1;
+    if (segments != (mcu_rows + rows_per_segment - 1) / rows_per_segment
+        || r.width != (int) obs_frame->width || r.height != (int) obs_frame->height)
+        return false;
+
+    const int n = (segments < count) ? segments : count;
+    if (n < 2)
+        return false;
+
+    for (int s = 0; s < n; s++) {
+        MJpegStripe *stripe = &stripes[s];
+        const int first = s * segments / n;
+        const int last  = (s + 1) * segments / n; // exclusive
+        const size_t seg_start = (first == 0) ? r.scan : r.marker[first - 1] + 2;
+        const size_t seg_end   = (last - 1 < r.count) ? r.marker[last - 1] : r.end;
+
+        const int y = first * rows_per_segment * r.mcu_h;
+        int height = (last - first) * rows_per_segment * r.mcu_h;
+        if (y + height > r.height)
+            height = r.height - y;
+
+        // header with the stripe height, entropy data, EOI
+        const size_t need = r.scan + (seg_end - seg_start) + 2;
+        if (need > stripe->jpeg_size) {
+            stripe->jpeg = (uint8_t*) brealloc(stripe->jpeg, need);
+            stripe->jpeg_size = need;
+        }
+
+        uint8_t *jpeg = stripe->jpeg;
+        memcpy(jpeg, data, r.scan);
+        jpeg[r.sof_height]     = (uint8_t) (height >> 8);
+        jpeg[r.sof_height + 1] = (uint8_t) (height & 0xFF);
+        memcpy(&jpeg[r.scan], &data[seg_start], seg_end - seg_start);
+
+        // the decoder expects RST0 after the first interval of each scan
+        for (int j = first; j < last - 1; j++)
+            jpeg[r.scan + (r.marker[j] - seg_start) + 1] = (uint8_t) (0xD0 + ((j - first) & 7));
+
+        stripe->jpeg_len = need;
+        jpeg[need - 2] = 0xFF;
+        jpeg[need - 1] = 0xD9;
+
+        for (int i = 0; i < 3; i++) {
+            const int rows = (y == 0) ? 0 : tjPlaneHeight(i, y, subsamp);
+            stripe->planes[i] = obs_frame->data[i] + (size_t) rows * obs_frame->linesize[i];
+            stripe->strides[i] = (int) obs_frame->linesize[i];
+        }
+        stripe->width = r.width;
+        stripe->height = height;
+        stripe->ok = false;
+    }
+
+    pending = n - 1;
+    for (int s = 0; s < n - 1; s++)
+        os_event_signal(stripes[s].start);
+
+    MJpegStripe *stripe = &stripes[n - 1];
+    stripe->ok = tjDecompressToYUVPlanes(stripe->tj,
+        stripe->jpeg, stripe->jpeg_len,
+        stripe->planes, stripe->width, stripe->strides, stripe->height,
+        TJFLAG_FASTDCT | TJFLAG_FASTUPSAMPLE) == 0;
+
+    while (pending > 0)
+        os_event_wait(done);
+
+    *ok = true;
+    for (int s = 0; s < n; s++)
+        *ok = *ok && stripes[s].ok;
+
+    return true;
+}
+
+static void *mjpeg_worker_thread(void *data) {
+    MJpegWorker *w = (MJpegWorker*) data;
+    os_set_thread_name("droidcam-mjpeg");
+
+    while (true) {
+        os_event_wait(w->start);
+        if (w->parent->stopping)
+            break;
+
+        uint64_t start = os_gettime_ns();
+        w->ok = w->ctx.decode(&w->frame, w->packet);
+        w->busy_ns += os_gettime_ns() - start;
+        w->frames ++;
+
+        w->state = WORKER_DONE;
+        os_event_signal(w->done);
+        if (w->parent->output_signal)
+            os_event_signal(w->parent->output_signal);
+    }
+
+    return NULL;
+}
+
+MJpegDecoder::~MJpegDecoder(void) {
+    if (main.striped_frames) {
+        ilog("~mjpeg single-frame decode: whole %.2fms (%llu frames), %d stripes %.2fms (%llu frames)",
+            main.whole_frames ? (double) main.whole_ns / (double) main.whole_frames / 1000000.0 : 0.0,
+            (unsigned long long) main.whole_frames,
+            main.stripes->count,
+            (double) main.striped_ns / (double) main.striped_frames / 1000000.0,
+            (unsigned long long) main.striped_frames);
+    }
+
+    if (!workers)
+        return;
+
+    stopping = true;
+    uint64_t frames = 0;
+    double capacity = 0;
+    for (int i = 0; i < worker_count; i++) {
+        MJpegWorker *w = &workers[i];
+        os_event_signal(w->start);
+        pthread_join(w->thread, NULL);
+        os_event_destroy(w->start);
+        os_event_destroy(w->done);
+
+        // the decode thread is gone by now
+        if (w->packet) {
+            delete w->packet;
+            alloc_count --;
+        }
+
+        frames += w->frames;
+        if (w->busy_ns)
+            capacity += (double) w->frames * 1000000000.0 / (double) w->busy_ns;
+    }
+
+    for (DataPacket* p : waiting) {
+        delete p;
+        alloc_count --;
+    }
+
+    if (frames) {
+        double elapsed = (double) (os_gettime_ns() - start_ts) / 1000000000.0;
+        ilog("~mjpeg %d workers: %llu frames, %.1f fps actual, %.1f fps capacity",
+            worker_count, (unsigned long long) frames,
+            elapsed > 0 ? (double) frames / elapsed : 0.0, capacity);
+    }
+
+    delete[] workers;
+}
+
+bool MJpegDecoder::start_workers(int count) {
+    workers = new MJpegWorker[count];
+    for (int i = 0; i < count; i++) {
+        MJpegWorker *w = &workers[i];
+        w->parent = this;
+        w->packet = NULL;
+        w->state = WORKER_IDLE;
+        w->ok = false;
+        w->frames = 0;
+        w->busy_ns = 0;
+        memset(&w->frame, 0, sizeof(w->frame));
+        w->start = NULL;
+        w->done = NULL;
+
+        w->ctx.tj = tjInitDecompress();
+        if (!w->ctx.tj
+            || os_event_init(&w->start, OS_EVENT_TYPE_AUTO) != 0
+            || os_event_init(&w->done, OS_EVENT_TYPE_AUTO) != 0
+            || pthread_create(&w->thread, NULL, mjpeg_worker_thread, w) != 0)
+        {
+            elog("error creating mjpeg worker %d", i);
+            // the destructor only stops the workers before this one
+            if (w->start) os_event_destroy(w->start);
+            if (w->done) os_event_destroy(w->done);
+            w->start = w->done = NULL;
+            worker_count = i;
+            return false;
+        }
+
+        worker_count = i + 1;
+    }
+
+    return true;
+}
+
+bool MJpegDecoder::init(void) {
+    if (main.tj || workers) {
+        elog("tj != NULL on init");
+        return false;
+    }
+
+    // A pool only helps when one core can't keep up, and there are cores to spare
+    const int cores = os_get_logical_cores();
+    int count = 0;
+    if (threading == THREADING_FRAME
+        || (threading == THREADING_AUTO && width_hint * height_hint >= 1920 * 1080))
     {
-        elog("tjDecompressToYUV2 failure: %d\n", tjGetErrorCode(tj));
+        count = cores - 1;
+        if (count > MJPEG_MAX_WORKERS) count = MJPEG_MAX_WORKERS;
+        if (count < 2) count = 0;
+    }
+
+    if (count) {
+        if (!start_workers(count)) {
+            // partially started workers are stopped in the destructor
+            return false;
+        }
+        ilog("mjpeg: %d decode workers (%d cores)", worker_count, cores);
+        start_ts = os_gettime_ns();
+        ready = true;
+        return true;
+    }
+
+    main.tj = tjInitDecompress();
+    if (!main.tj) {
+        elog("error creating mjpeg decoder: %s", tjGetErrorStr2(NULL));
         return false;
     }
 
-    obs_frame->flip = false;
+    // Split frames with restart markers across cores, for latency
+    if (threading == THREADING_SLICE && cores >= 2) {
+        main.stripes = new MJpegStripes();
+        if (!main.stripes->init(cores < MJPEG_MAX_STRIPES ? cores : MJPEG_MAX_STRIPES)) {
+            elog("error creating mjpeg stripe workers");
+            delete main.stripes;
+            main.stripes = NULL;
+        } else {
+            ilog("mjpeg: up to %d stripes per frame (%d cores)", main.stripes->count, cores);
+        }
+    }
+
+    ready = true;
+    return true;
+}
+
+// Decode thread: return packets of frames OBS already copied
+void MJpegDecoder::release_emitted(void) {
+    for (int i = 0; i < worker_count; i++) {
+        MJpegWorker *w = &workers[i];
+        if (w->state == WORKER_EMITTED) {
+            push_empty_packet(w->packet);
+            w->packet = NULL;
+            w->state = WORKER_IDLE;
+        }
+    }
+}
+
+// Decode thread: hand waiting packets to idle workers, in sequence
+void MJpegDecoder::dispatch(void) {
+    while (!waiting.empty()) {
+        MJpegWorker *w = &workers[next_in % worker_count];
+        if (w->state != WORKER_IDLE)
+            break;
+
+        w->packet = waiting.front();
+        w->ctx.display_width = main.display_width;
+        w->ctx.display_height = main.display_height;
+        waiting.pop_front();
+        w->state = WORKER_BUSY;
+        next_in ++;
+        os_event_signal(w->start);
+    }
+}
+
+void MJpegDecoder::flush(void) {
+    for (int i = 0; i < worker_count; i++) {
+        MJpegWorker *w = &workers[i];
+        while (w->state == WORKER_BUSY)
+            os_event_wait(w->done);
+
+        if (w->packet) {
+            push_empty_packet(w->packet);
+            w->packet = NULL;
+        }
+        w->state = WORKER_IDLE;
+    }
+
+    for (DataPacket* p : waiting)
+        push_empty_packet(p);
+
+    waiting.clear();
+    next_in = next_out = 0;
+    Decoder::flush();
+}
+
+bool MJpegDecoder::decode_video(struct obs_source_frame2* obs_frame, DataPacket* data_packet,
+        bool *got_output)
+{
+    *got_output = false;
+
+    // one snapshot per frame, so width and height always go together
+    if (data_packet) {
+        const uint32_t size = display_size;
+        main.display_width = (int) (size >> 16);
+        main.display_height = (int) (size & 0xFFFF);
+    }
+
+    if (worker_count == 0) {
+        if (!data_packet)
+            return true;
+
+        *got_output = main.decode(obs_frame, data_packet);
+        frame_pts = data_packet->pts;
+        return *got_output;
+    }
+
+    release_emitted();
+    if (data_packet)
+        waiting.push_back(data_packet);
+
+    dispatch();
+
+    // Only block when every worker is busy and input is backing up
+    MJpegWorker *w = &workers[next_out % worker_count];
+    if (!waiting.empty()) {
+        while (w->state == WORKER_BUSY)
+            os_event_wait(w->done);
+    }
+
+    if (w->state != WORKER_DONE)
+        return true;
+
+    // the worker's buffer stays untouched until the next call
+    next_out ++;
+    w->state = WORKER_EMITTED;
+    if (!w->ok)
+        return false;
+
+    *obs_frame = w->frame;
+    frame_pts = w->packet->pts;
     *got_output = true;
     return true;
 }
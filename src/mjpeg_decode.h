@@ -4,20 +4,150 @@
 
 extern "C" {
 #include <obs.h>
+#include <util/threading.h>
 #include "turbojpeg.h"
 }
 
 #include "decoder.h"
 
-struct MJpegDecoder : Decoder {
+#define MJPEG_MAX_WORKERS 8
+#define MJPEG_MAX_STRIPES 8
+#define MJPEG_MAX_RESTARTS 1024
+
+struct MJpegStripes;
+
+// One horizontal band of a frame, rebuilt as a standalone JPEG
+struct MJpegStripe {
+    MJpegStripes *pool;
+    tjhandle tj;
+    pthread_t thread;
+    os_event_t *start;
+    uint8_t *jpeg;
+    size_t jpeg_size;
+    size_t jpeg_len;
+    unsigned char *planes[3];
+    int strides[3];
+    int width;
+    int height;
+    bool ok;
+    bool running;
+};
+
+// Splits frames that use restart markers (DRI/RSTn) at restart boundaries
+// and decodes the stripes concurrently, straight into the output planes.
+// The last stripe is decoded on the calling thread.
+struct MJpegStripes {
+    MJpegStripe stripes[MJPEG_MAX_STRIPES];
+    int count;
+    std::atomic<int> pending;
+    os_event_t *done;
+    volatile bool stopping;
+
+    MJpegStripes(void) {
+        count = 0;
+        pending = 0;
+        done = NULL;
+        stopping = false;
+    }
+
+    ~MJpegStripes(void);
+    bool init(int stripe_count);
+
+    // Returns false if the frame can't be split, nothing is written in that case
+    bool decode(const uint8_t *data, size_t len, struct obs_source_frame2*, int subsamp, bool *ok);
+};
+
+// turbojpeg handle and output planes for one decode context
+struct MJpegContext {
     tjhandle tj;
     uint8_t *frameBuf;
+    size_t frameBufSize;
+    int mWidth;
+    int mHeight;
     int mSubsamp;
 
-    MJpegDecoder(void) {
+    // decode scaled down to cover this size, 0 for full size.
+    // Only changed by the thread that decodes with this context.
+    int display_width;
+    int display_height;
+
+    // optional, to split single frames
+    MJpegStripes *stripes;
+    uint64_t whole_frames, whole_ns;
+    uint64_t striped_frames, striped_ns;
+
+    MJpegContext(void) {
         tj = NULL;
         frameBuf = NULL;
-        mSubsamp = 0;
+        frameBufSize = 0;
+        mWidth = 0;
+        mHeight = 0;
+        mSubsamp = -1;
+        display_width = 0;
+        display_height = 0;
+        stripes = NULL;
+        whole_frames = whole_ns = 0;
+        striped_frames = striped_ns = 0;
+    }
+
+    ~MJpegContext(void);
+    bool decode(struct obs_source_frame2*, DataPacket*);
+    bool setup_frame(struct obs_source_frame2*, int width, int height, int subsamp);
+};
+
+enum MJpegWorkerState {
+    WORKER_IDLE,
+    WORKER_BUSY,
+    WORKER_DONE,
+    WORKER_EMITTED, // frame handed to OBS, released on the next decode_video() call
+};
+
+struct MJpegDecoder;
+
+struct MJpegWorker {
+    MJpegDecoder *parent;
+    MJpegContext ctx;
+    struct obs_source_frame2 frame;
+    pthread_t thread;
+    os_event_t *start;
+    os_event_t *done;
+    DataPacket *packet;
+    std::atomic<int> state;
+    bool ok;
+    uint64_t frames;
+    uint64_t busy_ns;
+};
+
+// Decodes inline on the decode thread, or (THREADING_FRAME) spreads
+// consecutive frames round-robin across worker threads, each with its own
+// turbojpeg handle and output buffer. Frames are emitted strictly in the
+// order they were queued. With THREADING_SLICE, single frames are split
+// at restart markers instead (see MJpegStripes).
+struct MJpegDecoder : Decoder {
+    MJpegContext main;
+    MJpegWorker *workers;
+    int worker_count;
+    uint64_t next_in;  // sequence number of the next frame to dispatch
+    uint64_t next_out; // sequence number of the next frame to emit
+    std::deque<DataPacket*> waiting;
+    volatile bool stopping;
+    uint64_t start_ts;
+
+    // signalled by workers when a frame is ready
+    os_event_t *output_signal;
+
+    // requested display size, width << 16 | height
+    std::atomic<uint32_t> display_size;
+
+    MJpegDecoder(void) {
+        workers = NULL;
+        worker_count = 0;
+        next_in = 0;
+        next_out = 0;
+        stopping = false;
+        start_ts = 0;
+        output_signal = NULL;
+        display_size = 0;
     }
 
     ~MJpegDecoder(void);
@@ -29,7 +159,37 @@ struct MJpegDecoder : Decoder {
         return false;
     }
 
-    void push_ready_packet(DataPacket*);
+    bool holds_packets(void) {
+        return worker_count > 0;
+    }
+
+    void flush(void);
+
+    // Receive thread: size the source is shown at, see MJpegContext.
+    // The decode thread picks it up at the next frame.
+    void set_display_size(int width, int height) {
+        if (width < 0 || width > 0xFFFF) width = 0;
+        if (height < 0 || height > 0xFFFF) height = 0;
+        display_size = (uint32_t) width << 16 | (uint32_t) height;
+    }
+
+    bool independent_frames(void) {
+        return true;
+    }
+
+    // Every frame is independent; just make sure it starts with a JPEG SOI marker
+    bool is_keyframe(DataPacket* packet) {
+        return is_keyframe_data(packet->data, packet->used);
+    }
+
+    bool is_keyframe_data(const uint8_t *data, size_t len) {
+        return len > 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+    }
+
+private:
+    bool start_workers(int count);
+    void dispatch(void);
+    void release_emitted(void);
 };
 
 #endif
@@ -0,0 +1,178 @@
+/*
+Copyright (C) 2025 DEV47APPS, github.com/dev47apps
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "nal_scan.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NAL_SCAN_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#define NAL_SCAN_AVX2 1
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define NAL_SCAN_NEON 1
+#include <arm_neon.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline int ctz32(uint32_t v) {
+    unsigned long i;
+    _BitScanForward(&i, v);
+    return (int) i;
+}
+#else
+#define ctz32(v) __builtin_ctz(v)
+#endif
+
+static inline size_t scan_scalar(const uint8_t *p, size_t len, size_t i) {
+    for (; i + 3 <= len; i++) {
+        if (p[i + 2] > 1) {
+            // p[i+2] can't be part of a start code at i, i+1 or i+2
+            i += 2;
+            continue;
+        }
+        if (p[i] == 0 && p[i + 1] == 0 && p[i + 2] == 1)
+            return i;
+    }
+    return len;
+}
+
+#if NAL_SCAN_AVX2
+__attribute__((target("avx2")))
+static size_t scan_avx2(const uint8_t *p, size_t len, size_t i) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one  = _mm256_set1_epi8(1);
+
+    for (; i + 34 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) &p[i]);
+        __m256i b = _mm256_loadu_si256((const __m256i*) &p[i + 1]);
+        __m256i c = _mm256_loadu_si256((const __m256i*) &p[i + 2]);
+        __m256i m = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, zero), _mm256_cmpeq_epi8(b, zero)),
+            _mm256_cmpeq_epi8(c, one));
+
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(m);
+        if (mask)
+            return i + ctz32(mask);
+    }
+
+    return scan_scalar(p, len, i);
+}
+
+static bool has_avx2(void) {
+    static int avx2 = -1;
+    if (avx2 < 0)
+        avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    return avx2 == 1;
+}
+#endif
+
+size_t nal_find_start_code(const uint8_t *p, size_t len, size_t i) {
+#if NAL_SCAN_AVX2
+    if (has_avx2())
+        return scan_avx2(p, len, i);
+#endif
+
+#if NAL_SCAN_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one  = _mm_set1_epi8(1);
+
+    for (; i + 18 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*) &p[i]);
+        __m128i b = _mm_loadu_si128((const __m128i*) &p[i + 1]);
+        __m128i c = _mm_loadu_si128((const __m128i*) &p[i + 2]);
+        __m128i m = _mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero)),
+            _mm_cmpeq_epi8(c, one));
+
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(m);
+        if (mask)
+            return i + ctz32(mask);
+    }
+
+#elif NAL_SCAN_NEON
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t one  = vdupq_n_u8(1);
+
+    for (; i + 18 <= len; i += 16) {
+        uint8x16_t a = vld1q_u8(&p[i]);
+        uint8x16_t b = vld1q_u8(&p[i + 1]);
+        uint8x16_t c = vld1q_u8(&p[i + 2]);
+        uint8x16_t m = vandq_u8(vandq_u8(vceqq_u8(a, zero), vceqq_u8(b, zero)), vceqq_u8(c, one));
+        if (vmaxvq_u8(m))
+            return scan_scalar(p, i + 18, i);
+    }
+#endif
+
+    return scan_scalar(p, len, i);
+}
+
+static FrameType classify_avc(uint8_t header) {
+    switch (header & 0x1f) {
+        case 5:
+            return FRAME_IDR;
+        case 1:
+            return ((header >> 5) & 3) ? FRAME_REF : FRAME_NONREF;
+    }
+    return FRAME_UNKNOWN;
+}
+
+static FrameType classify_hevc(uint8_t header) {
+    const int type = (header >> 1) & 0x3f;
+    if (type == 19 || type == 20) // IDR_W_RADL, IDR_N_LP
+        return FRAME_IDR;
+
+    if (type >= 16 && type <= 21) // BLA_* (16-18), CRA_NUT (21); IDR is caught above
+        return FRAME_CRA;
+
+    // TRAIL, TSA, STSA, RADL, RASL (0-9): the even _N types are sub-layer
+    // non-reference. 10-15 are reserved and count as unknown.
+    if (type <= 9)
+        return (type % 2 == 0) ? FRAME_NONREF : FRAME_REF;
+
+    return FRAME_UNKNOWN;
+}
+
+FrameType nal_classify(const uint8_t *data, size_t len, bool hevc) {
+    FrameType frame_type = FRAME_UNKNOWN;
+
+    size_t i = nal_find_start_code(data, len, 0);
+    while (i < len) {
+        const size_t header = i + 3;
+        if (header >= len)
+            break;
+
+        const FrameType t = hevc ? classify_hevc(data[header]) : classify_avc(data[header]);
+        if (t > frame_type)
+            frame_type = t;
+
+        i = nal_find_start_code(data, len, header);
+    }
+
+    return frame_type;
+}
+
+const char* frame_type_name(FrameType type) {
+    switch (type) {
+        case FRAME_NONREF: return "non-ref";
+        case FRAME_REF:    return "ref";
+        case FRAME_CRA:    return "CRA";
+        case FRAME_IDR:    return "IDR";
+        default:           return "unknown";
+    }
+}
@@ -0,0 +1,23 @@
+// Copyright (C) 2025 DEV47APPS, github.com/dev47apps
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Ordered so that the "strongest" type in an access unit wins
+enum FrameType {
+    FRAME_UNKNOWN,
+    FRAME_NONREF, // not used as a reference, safe to drop
+    FRAME_REF,
+    FRAME_CRA,    // HEVC CRA/BLA: random access point
+    FRAME_IDR,
+    FRAME_TYPE_COUNT,
+};
+
+// Offset of the next 00 00 01 start code at or after `pos`, or `len` if none.
+size_t nal_find_start_code(const uint8_t *data, size_t len, size_t pos);
+
+// Walk every NAL in an Annex-B AVC/HEVC access unit and classify it.
+FrameType nal_classify(const uint8_t *data, size_t len, bool hevc);
+
+const char* frame_type_name(FrameType type);
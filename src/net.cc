@@ -17,6 +17,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <errno.h>
 #include <string.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <util/platform.h>
 #include "plugin.h"
 #include "plugin_properties.h"
 #include "net.h"
@@ -32,6 +36,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 # include <netdb.h>
 # include <fcntl.h>
 # include <unistd.h>
+# include <poll.h>
+# include <sys/ioctl.h>
 #endif
 
 bool set_nonblock(socket_t sock, int nonblock) {
@@ -134,10 +140,41 @@ net_accept(socket_t sock) {
     return accept(sock, NULL, 0);
 }
 
-struct sockaddr*
-net_sock_addr(const char* host) {
-    struct addrinfo hints = {0}, *addr = 0, *addrs = 0;
+// Resolved addresses, cached per host name for NET_ADDR_CACHE_TTL_NS.
+// A host is dropped from the cache when no address for it connects.
+#define NET_ADDR_CACHE_TTL_NS (30 * 1000000000ULL)
+#define NET_MAX_ADDRS 8
+#define CONNECT_TIMEOUT_MS 2000
+#define CONNECT_STAGGER_MS 250 // head start for each address over the next one
+
+struct net_addr {
+    struct sockaddr_storage ss;
+    socklen_t len;
+};
+
+struct net_addr_entry {
+    uint64_t ts;
+    int count;
+    struct net_addr addrs[NET_MAX_ADDRS];
+};
+
+static std::mutex addr_cache_lock;
+static std::map<std::string, net_addr_entry> addr_cache;
+
+static int
+net_resolve(const char* host, struct net_addr *out, int max) {
+    const uint64_t now = os_gettime_ns();
+    {
+        std::lock_guard<std::mutex> lock(addr_cache_lock);
+        auto it = addr_cache.find(host);
+        if (it != addr_cache.end() && now - it->second.ts < NET_ADDR_CACHE_TTL_NS) {
+            const int count = it->second.count < max ? it->second.count : max;
+            memcpy(out, it->second.addrs, sizeof(struct net_addr) * count);
+            return count;
+        }
+    }
 
+    struct addrinfo hints = {0}, *addr = 0, *addrs = 0;
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_protocol = IPPROTO_TCP;
@@ -145,98 +182,100 @@ net_sock_addr(const char* host) {
     if (getaddrinfo(host, NULL, &hints, &addrs) != 0) {
         WSAErrno();
         elog("getaddrinfo failed (%d): %s", errno, strerror(errno));
-        return NULL;
+        return 0;
     }
 
-    addr = addrs;
+    net_addr_entry entry;
+    entry.ts = now;
+    entry.count = 0;
+    for (addr = addrs; addr && entry.count < NET_MAX_ADDRS; addr = addr->ai_next) {
+        if (addr->ai_addrlen > sizeof(struct sockaddr_storage))
+            continue;
+
+        struct net_addr *a = &entry.addrs[entry.count++];
+        memset(&a->ss, 0, sizeof(a->ss));
+        memcpy(&a->ss, addr->ai_addr, addr->ai_addrlen);
+        a->len = (socklen_t) addr->ai_addrlen;
+    }
+    freeaddrinfo(addrs);
+
+    std::lock_guard<std::mutex> lock(addr_cache_lock);
+    addr_cache[host] = entry;
 
-    return addr->ai_addr;
+    const int count = entry.count < max ? entry.count : max;
+    memcpy(out, entry.addrs, sizeof(struct net_addr) * count);
+    return count;
 }
 
-socket_t
-net_connect(struct addrinfo *addr, struct sockaddr* bind_saddr, uint16_t port) {
-    struct sockaddr* ai_addr = addr->ai_addr;
-    void *in_addr;
-    int rc;
-
-    switch (ai_addr->sa_family) {
-        case AF_INET: {
-            struct sockaddr_in* sa = (struct sockaddr_in*) ai_addr;
-            in_addr = &(sa->sin_addr);
-            sa->sin_port = htons(port);
-            break;
-        }
-        case AF_INET6: {
-            struct sockaddr_in6* sa = (struct sockaddr_in6*) ai_addr;
-            in_addr = &(sa->sin6_addr);
-            sa->sin6_port = htons(port);
-            break;
-        }
-    }
+static void
+net_resolve_forget(const char* host) {
+    std::lock_guard<std::mutex> lock(addr_cache_lock);
+    addr_cache.erase(host);
+}
 
-    #ifdef DEBUG
-    char str[INET6_ADDRSTRLEN] = {0};
-    inet_ntop(addr->ai_family, in_addr, str, sizeof(str));
-    dlog("trying %s", str);
-    #else
-    (void) in_addr;
-    #endif
+bool
+net_sock_addr(const char* host, struct sockaddr_storage *out) {
+    struct net_addr addr;
+    if (net_resolve(host, &addr, 1) == 0)
+        return false;
 
-    socket_t sock = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    memcpy(out, &addr.ss, sizeof(addr.ss));
+    return true;
+}
+
+static const char*
+net_addr_str(const struct sockaddr_storage *ss, char *str, size_t len) {
+    const void *in_addr = (ss->ss_family == AF_INET6)
+        ? (const void*) &((const struct sockaddr_in6*) ss)->sin6_addr
+        : (const void*) &((const struct sockaddr_in*) ss)->sin_addr;
+
+    if (!inet_ntop(ss->ss_family, (void*) in_addr, str, len))
+        snprintf(str, len, "?");
+
+    return str;
+}
+
+// Start a non-blocking connect; returns the socket with the connect in progress
+static socket_t
+net_connect_start(struct net_addr *addr, const struct sockaddr_storage *bind_ss, uint16_t port) {
+    if (addr->ss.ss_family == AF_INET6)
+        ((struct sockaddr_in6*) &addr->ss)->sin6_port = htons(port);
+    else
+        ((struct sockaddr_in*) &addr->ss)->sin_port = htons(port);
+
+    socket_t sock = socket(addr->ss.ss_family, SOCK_STREAM, IPPROTO_TCP);
     if (sock == INVALID_SOCKET) {
         WSAErrno();
         elog("socket(): %s", strerror(errno));
         return INVALID_SOCKET;
     }
 
-    if (bind_saddr && bind_saddr->sa_family == ai_addr->sa_family) {
-        const size_t addrlen = (bind_saddr->sa_family == AF_INET)
+    if (bind_ss && bind_ss->ss_family == addr->ss.ss_family) {
+        const socklen_t addrlen = (bind_ss->ss_family == AF_INET)
             ? sizeof(struct sockaddr_in)
             : sizeof(struct sockaddr_in6);
 
-        if (bind(sock, bind_saddr, addrlen) < 0) {
+        if (bind(sock, (const struct sockaddr*) bind_ss, addrlen) < 0) {
             WSAErrno();
             elog("bind failed: %s", strerror(errno));
         }
     }
 
-    struct timeval timeout;
-    timeout.tv_sec = 2;
-    timeout.tv_usec = 0;
-
-    fd_set set;
-    FD_ZERO(&set);
-    FD_SET(sock, &set);
-
     if (!set_nonblock(sock, 1)) {
-        goto ERROR_OUT;
+        net_close(sock);
+        return INVALID_SOCKET;
     }
 
-    connect(sock, addr->ai_addr, addr->ai_addrlen);
+    if (connect(sock, (struct sockaddr*) &addr->ss, addr->len) == 0)
+        return sock;
 
 #if _WIN32
-    if (WSAGetLastError() != WSAEWOULDBLOCK)
-        goto ERROR_OUT;
+    if (WSAGetLastError() != WSAEWOULDBLOCK) {
 #else
     if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINPROGRESS) {
-        WSAErrno();
-        elog("connect(): %s", strerror(errno));
-        goto ERROR_OUT;
-    }
 #endif
-
-    rc = select(sock+1, NULL, &set, NULL, &timeout);
-    if (rc == 0)
-        goto ERROR_OUT;
-
-    if (rc < 0) {
         WSAErrno();
-        elog("connect failed: %s", strerror(errno));
-        goto ERROR_OUT;
-    }
-
-    if (!set_nonblock(sock, 0)) {
-    ERROR_OUT:
+        dlog("connect(): %s", strerror(errno));
         net_close(sock);
         return INVALID_SOCKET;
     }
@@ -244,37 +283,116 @@ net_connect(struct addrinfo *addr, struct sockaddr* bind_saddr, uint16_t port) {
     return sock;
 }
 
+static int
+net_sock_error(socket_t sock) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, (char*) &err, &len) != 0) {
+        WSAErrno();
+        return errno ? errno : -1;
+    }
+    return err;
+}
+
+// Happy eyeballs (RFC 8305 style): every resolved address gets a connect
+// attempt, each starting CONNECT_STAGGER_MS after the previous one (or right
+// away when the previous one fails). The first to complete wins.
 socket_t
 net_connect(const char* host, const char* bindIP, uint16_t port) {
     dlog("connect: %s port %d / bindIP=%s", host, port, bindIP);
 
-    struct sockaddr* bind_saddr = NULL;
-    if (bindIP && bindIP[0]) {
-        bind_saddr = net_sock_addr(bindIP);
+    struct net_addr addrs[NET_MAX_ADDRS];
+    const int count = net_resolve(host, addrs, NET_MAX_ADDRS);
+    if (count == 0)
+        return INVALID_SOCKET;
+
+    struct sockaddr_storage bind_ss;
+    const bool use_bind = bindIP && bindIP[0] && net_sock_addr(bindIP, &bind_ss);
+
+    struct pollfd fds[NET_MAX_ADDRS];
+    int attempt[NET_MAX_ADDRS];
+    uint64_t started[NET_MAX_ADDRS];
+    int active = 0;
+    int next = 0;
+    char str[64];
+
+    const uint64_t begin = os_gettime_ns();
+    uint64_t next_start = begin;
+    uint64_t deadline = begin + CONNECT_TIMEOUT_MS * 1000000ULL;
+    socket_t winner = INVALID_SOCKET;
+
+    while (winner == INVALID_SOCKET) {
+        uint64_t now = os_gettime_ns();
+        if (next < count && (now >= next_start || active == 0)) {
+            socket_t sock = net_connect_start(&addrs[next], use_bind ? &bind_ss : NULL, port);
+            if (sock != INVALID_SOCKET) {
+                fds[active].fd = sock;
+                fds[active].events = POLLOUT;
+                fds[active].revents = 0;
+                attempt[active] = next;
+                started[active] = now;
+                active++;
+                deadline = now + CONNECT_TIMEOUT_MS * 1000000ULL;
+            }
+            next++;
+            next_start = now + CONNECT_STAGGER_MS * 1000000ULL;
+            continue;
+        }
+
+        if (active == 0 || now >= deadline)
+            break;
+
+        uint64_t wake = deadline;
+        if (next < count && next_start < wake)
+            wake = next_start;
+
+        int rc = poll(fds, active, (int) ((wake - now + 999999) / 1000000));
+        if (rc < 0) {
+            WSAErrno();
+            elog("poll(): %s", strerror(errno));
+            break;
+        }
+
+        now = os_gettime_ns();
+        for (int i = 0; i < active; i++) {
+            if (fds[i].revents == 0)
+                continue;
+
+            const int err = net_sock_error(fds[i].fd);
+            const double ms = (double) (now - started[i]) / 1000000.0;
+            net_addr_str(&addrs[attempt[i]].ss, str, sizeof(str));
+            if (err == 0 && winner == INVALID_SOCKET) {
+                ilog("connected to %s port %d in %.1fms (address %d/%d)", str, port, ms, attempt[i] + 1, count);
+                winner = fds[i].fd;
+            } else {
+                dlog("connect %s: %s after %.1fms", str, err ? strerror(err) : "lost race", ms);
+                net_close(fds[i].fd);
+                next_start = now; // no need to wait for the next address
+            }
+
+            fds[i] = fds[active - 1];
+            attempt[i] = attempt[active - 1];
+            started[i] = started[active - 1];
+            active--;
+            i--;
+        }
+    }
+
+    for (int i = 0; i < active; i++) {
+        dlog("connect %s: timeout/abandoned", net_addr_str(&addrs[attempt[i]].ss, str, sizeof(str)));
+        net_close(fds[i].fd);
     }
 
-    struct addrinfo hints = {0}, *addr = 0, *addrs = 0;
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
+    if (winner == INVALID_SOCKET || !set_nonblock(winner, 0)) {
+        if (winner != INVALID_SOCKET)
+            net_close(winner);
 
-    if (getaddrinfo(host, NULL, &hints, &addrs) != 0) {
-        WSAErrno();
-        elog("getaddrinfo failed (%d): %s", errno, strerror(errno));
+        net_resolve_forget(host);
         return INVALID_SOCKET;
     }
 
-    addr = addrs;
-    do {
-        socket_t sock = net_connect(addr, bind_saddr, port);
-        if (sock != INVALID_SOCKET) {
-            set_recv_timeout(sock, 5);
-            return sock;
-        }
-    } while ((addr = addr->ai_next) != NULL);
-
-    freeaddrinfo(addrs);
-    return INVALID_SOCKET;
+    set_recv_timeout(winner, RECV_TIMEOUT_SEC);
+    return winner;
 }
 
 ssize_t
@@ -292,6 +410,20 @@ net_recv_peek(socket_t sock) {
     return recv(sock, buf, 1, MSG_PEEK);
 }
 
+ssize_t
+net_recv_pending(socket_t sock) {
+#if _WIN32
+    u_long n = 0;
+    if (ioctlsocket(sock, FIONREAD, &n) != 0)
+        return -1;
+#else
+    int n = 0;
+    if (ioctl(sock, FIONREAD, &n) != 0)
+        return -1;
+#endif
+    return (ssize_t) n;
+}
+
 ssize_t
 net_recv_all(socket_t sock, void *buf, size_t len) {
 #if _WIN32
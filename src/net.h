@@ -19,14 +19,13 @@
   typedef int socket_t;
 #endif
 
+#define RECV_TIMEOUT_SEC 5
+
 bool net_init(void);
 void net_cleanup(void);
 void net_close(socket_t sock);
 socket_t net_accept(socket_t sock);
 
-socket_t
-net_connect(struct addrinfo *addr, struct sockaddr* bind_saddr, uint16_t port);
-
 socket_t
 net_connect(const char* host, const char* bindIP, uint16_t port);
 
@@ -45,6 +44,10 @@ net_recv(socket_t sock, void *buf, size_t len);
 ssize_t
 net_recv_peek(socket_t sock);
 
+// Bytes received by the kernel but not read yet (FIONREAD), or -1
+ssize_t
+net_recv_pending(socket_t sock);
+
 ssize_t
 net_recv_all(socket_t sock, void *buf, size_t len);
 
@@ -63,5 +66,6 @@ set_recv_buf_len(socket_t sock, int len);
 bool
 set_nonblock(socket_t sock, int nonblock);
 
-struct sockaddr*
-net_sock_addr(const char* host);
+// Resolve `host` (cached) to its first address
+bool
+net_sock_addr(const char* host, struct sockaddr_storage *out);
@@ -42,6 +42,11 @@ AddDevice* addDevUI = NULL;
 #include "plugin.h"
 #include "source.h"
 #include "plugin_properties.h"
+#include "ffmpeg_decode.h"
+#include "net.h"
+#include "device_discovery.h"
+#include "reconnect.h"
+#include "reactor.h"
 
 const char* bindIP = NULL;
 char os_name_version[64];
@@ -176,4 +181,7 @@ bool obs_module_load(void) {
 }
 
 void obs_module_unload(void) {
+    ffmpeg_hw_cache_free();
+    reconnect_scheduler_free();
+    reactor_free();
 }
@@ -26,3 +26,6 @@ void droidcam_signal(obs_source_t* source, const char* signal);
 #endif
 
 void get_os_name_version(char *, size_t);
+
+// CPU time used by the calling thread so far
+uint64_t get_thread_cpu_ns(void);
@@ -21,6 +21,14 @@
 #define OPT_ACTIVE_DEV_TYPE   "cur_dev_type"
 #define OPT_UHD_UNLOCK        "uhd_unlock"
 #define OPT_DUMMY_SOURCE      "dummy_source"
+#define OPT_DROP_POLICY       "drop_policy"
+#define OPT_LATENCY_BUDGET    "latency_budget"
+#define OPT_DECODE_THREADING  "decode_threading"
+#define OPT_RECOVERY_LIMIT    "recovery_limit"
+#define OPT_RECOVERY_WINDOW   "recovery_window"
+#define OPT_SCALE_TO_DISPLAY  "scale_to_display"
+#define OPT_AUDIO_JITTER      "audio_jitter_buffer"
+#define OPT_AUDIO_ONLY        "audio_only"
 
 #define TEXT_DEVICE         obs_module_text("Device")
 #define TEXT_REFRESH        obs_module_text("Refresh")
@@ -36,6 +44,20 @@
 #define TEXT_USE_HW_ACCEL   obs_module_text("AllowHWAccel")
 #define TEXT_LATENCY_TOGGLE obs_module_text("LatencyToggle")
 #define TEXT_LATENCY_DESCR  obs_module_text("LatencyToolTip")
+#define TEXT_DROP_POLICY    obs_module_text("DropPolicy")
+#define TEXT_DROP_TO_KEYFRAME obs_module_text("DropPolicy.Keyframe")
+#define TEXT_DROP_OLDEST    obs_module_text("DropPolicy.Oldest")
+#define TEXT_DROP_NEVER     obs_module_text("DropPolicy.Never")
+#define TEXT_LATENCY_BUDGET obs_module_text("LatencyBudget")
+#define TEXT_DECODE_THREADING obs_module_text("DecodeThreading")
+#define TEXT_THREADING_AUTO   obs_module_text("DecodeThreading.Auto")
+#define TEXT_THREADING_SLICE  obs_module_text("DecodeThreading.Slice")
+#define TEXT_THREADING_FRAME  obs_module_text("DecodeThreading.Frame")
+#define TEXT_RECOVERY_LIMIT   obs_module_text("RecoveryLimit")
+#define TEXT_RECOVERY_WINDOW  obs_module_text("RecoveryWindow")
+#define TEXT_SCALE_TO_DISPLAY obs_module_text("ScaleToDisplay")
+#define TEXT_AUDIO_JITTER     obs_module_text("AudioJitterBuffer")
+#define TEXT_AUDIO_ONLY       obs_module_text("AudioOnly")
 
 #define PING_REQ "GET /ping"
 #define BATT_REQ "GET /battery HTTP/1.1\r\n\r\n"
@@ -15,14 +15,23 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #ifndef _WIN32
-# include <sys/select.h>
+# include <unistd.h>
+# include <sys/socket.h>
+#endif
+#ifdef __linux__
+# include <fcntl.h>
+# include <sys/epoll.h>
+#elif !defined(_WIN32)
+# include <poll.h>
 #endif
 #include <util/platform.h>
 #if defined(TEST)
 #include <util/bmem.h>
 #endif
 
+#include <algorithm>
 #include <deque>
+#include <vector>
 
 #include "plugin.h"
 #include "plugin_properties.h"
@@ -35,7 +44,6 @@ Proxy::Proxy(DeviceDiscovery* device_discovery) {
     port_local = 0;
     port_remote = 0;
     thread_active = 0;
-    proxy_device = NULL;
     proxy_sock = INVALID_SOCKET;
     discovery_mgr = device_discovery;
 }
@@ -49,8 +57,11 @@ Proxy::~Proxy() {
 }
 
 int Proxy::Start(Device *dev, int remote_port) {
-    proxy_device = dev;
-    port_remote = remote_port;
+    {
+        std::lock_guard<std::mutex> guard(device_lock);
+        proxy_device = *dev;
+        port_remote = remote_port;
+    }
 
     if (thread_active == 0) {
         if (proxy_sock != INVALID_SOCKET)
@@ -60,8 +71,10 @@ int Proxy::Start(Device *dev, int remote_port) {
         port_local = (proxy_sock != INVALID_SOCKET)
                     ? net_listen_port(proxy_sock) : 0;
 
-        thread_active = port_local > 0
-            && pthread_create(&pthr, NULL, proxy_run, this) == 0;
+        // set before the thread starts, it exits as soon as this is 0
+        thread_active = port_local > 0;
+        if (thread_active && pthread_create(&pthr, NULL, proxy_run, this) != 0)
+            thread_active = 0;
 
         if(!thread_active) {
             elog("Error creating iproxy server/thread");
@@ -72,147 +85,398 @@ int Proxy::Start(Device *dev, int remote_port) {
     return port_local;
 }
 
-struct proxy_conn {
-    socket_t client;
-    socket_t remote;
-    proxy_conn(socket_t c, socket_t r) {
-        client = c; remote = r;
-    }
-};
-
-#define BUF_SIZE 32768
+#define PROXY_BUF_SIZE 65536
+#define PROXY_WAIT_MS 500    // idle wakeups, only to notice thread_active going away
+#define PROXY_MAX_EVENTS 64
+#define PROXY_PUMP_LIMIT 16  // reads per direction before servicing other connections
 #ifdef DEBUG
 #define vlog dlog
 #else
 #define vlog(...)
 #endif
 
+// One direction of a connection. Data read from `from` is held (in a pipe for
+// splice(), otherwise in buf) until `to` takes it. While anything is held,
+// `from` is not read, so a slow reader pushes back on the writer instead of
+// the proxy buffering without bound.
+struct proxy_half {
+    socket_t from;
+    socket_t to;
+    uint8_t *buf;
+    size_t offset;   // of the first held byte in buf
+    size_t pending;  // held bytes
+    uint64_t bytes;
+    bool eof;        // `from` is shut down...
+    bool done;       // ... and, everything relayed, so is `to`
+    #ifdef __linux__
+    int pipe_fd[2];  // -1 when falling back to buf
+    #endif
+};
+
+struct proxy_conn {
+    socket_t client;
+    socket_t remote;
+    proxy_half half[2]; // client => remote, remote => client
+    bool more;          // stopped at PROXY_PUMP_LIMIT with data still flowing
+    bool closed;
+};
+
+static bool would_block(void) {
+    #ifdef _WIN32
+    WSAErrno();
+    return errno == WSAEWOULDBLOCK;
+    #else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+    #endif
+}
+
+static void half_init(proxy_half *h, socket_t from, socket_t to) {
+    h->from = from;
+    h->to = to;
+    h->buf = NULL;
+    h->offset = 0;
+    h->pending = 0;
+    h->bytes = 0;
+    h->eof = false;
+    h->done = false;
+    #ifdef __linux__
+    if (pipe2(h->pipe_fd, O_NONBLOCK | O_CLOEXEC) != 0) {
+        elog("proxy: pipe2 failed (%d): %s", errno, strerror(errno));
+        h->pipe_fd[0] = h->pipe_fd[1] = -1;
+    }
+    #endif
+}
+
+static void half_free(proxy_half *h) {
+    if (h->buf) bfree(h->buf);
+    #ifdef __linux__
+    if (h->pipe_fd[0] >= 0) close(h->pipe_fd[0]);
+    if (h->pipe_fd[1] >= 0) close(h->pipe_fd[1]);
+    #endif
+}
+
+// Relay until a socket would block, `from` ends, or PROXY_PUMP_LIMIT reads
+// (then `*more` is set). Returns false on a socket error.
+static bool half_pump(proxy_half *h, bool *more) {
+    for (int reads = 0; ; ) {
+        while (h->pending > 0) {
+            ssize_t n;
+            #ifdef __linux__
+            if (h->pipe_fd[0] >= 0)
+                n = splice(h->pipe_fd[0], NULL, h->to, NULL, h->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            else
+            #endif
+                n = net_send(h->to, &h->buf[h->offset], h->pending);
+
+            if (n <= 0)
+                return n < 0 && would_block();
+
+            h->offset += n;
+            h->pending -= n;
+            h->bytes += n;
+        }
+
+        if (h->eof) {
+            if (!h->done) {
+                shutdown(h->to, SHUT_WR);
+                h->done = true;
+            }
+            return true;
+        }
+
+        if (reads++ == PROXY_PUMP_LIMIT) {
+            *more = true;
+            return true;
+        }
+
+        ssize_t n;
+        #ifdef __linux__
+        if (h->pipe_fd[1] >= 0) {
+            n = splice(h->from, NULL, h->pipe_fd[1], NULL, PROXY_BUF_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        }
+        else
+        #endif
+        {
+            if (!h->buf) h->buf = (uint8_t*) bmalloc(PROXY_BUF_SIZE);
+            n = net_recv(h->from, h->buf, PROXY_BUF_SIZE);
+        }
+
+        if (n < 0)
+            return would_block();
+
+        if (n == 0)
+            h->eof = true;
+
+        h->offset = 0;
+        h->pending = n;
+    }
+}
+
+// Returns false once the connection is finished
+static bool conn_service(proxy_conn *c) {
+    c->more = false;
+    if (!half_pump(&c->half[0], &c->more) || !half_pump(&c->half[1], &c->more)) {
+        WSAErrno();
+        vlog("proxy: %d <==> %d error (%d): %s", (int) c->client, (int) c->remote, errno, strerror(errno));
+        return false;
+    }
+
+    return !(c->half[0].done && c->half[1].done);
+}
+
+static proxy_conn *conn_create(socket_t client, socket_t remote) {
+    proxy_conn *c = new proxy_conn();
+    c->client = client;
+    c->remote = remote;
+    c->more = false;
+    c->closed = false;
+    half_init(&c->half[0], client, remote);
+    half_init(&c->half[1], remote, client);
+    return c;
+}
+
+static void conn_free(proxy_conn *c) {
+    vlog("proxy: %d <==> %d close, %llu/%llu bytes", (int) c->client, (int) c->remote,
+        (unsigned long long) c->half[0].bytes, (unsigned long long) c->half[1].bytes);
+    net_close(c->client);
+    net_close(c->remote);
+    half_free(&c->half[0]);
+    half_free(&c->half[1]);
+    delete c;
+}
+
+// Accept one pending client and connect it through to the device
+static proxy_conn *proxy_accept(Proxy *proxy) {
+    socket_t client = net_accept(proxy->proxy_sock);
+    if (client == INVALID_SOCKET)
+        return NULL;
+
+    // Start() may switch devices while we connect
+    Device dev;
+    int port_remote;
+    {
+        std::lock_guard<std::mutex> guard(proxy->device_lock);
+        dev = proxy->proxy_device;
+        port_remote = proxy->port_remote;
+    }
+
+    // todo: make connect function generic, usbmux hacked in here for now
+    #ifdef _WIN32
+    auto usbmux = (USBMux*) proxy->discovery_mgr;
+    int rc = usbmux->usbmuxd_connect(
+        (uint32_t) dev.handle,
+        (short) port_remote);
+
+    #elif __linux__
+    int rc = usbmuxd_connect(
+        (uint32_t) dev.handle,
+        (short) port_remote);
+
+    #elif __APPLE__
+    int rc = net_connect(
+        (const char*) dev.address,
+        port_remote);
+
+    #else
+    #error Unknown System
+    #endif
+
+    if (rc <= 0) {
+        elog("proxy: remote connection failed");
+        net_close(client);
+        return NULL;
+    }
+
+    socket_t remote = rc;
+    vlog("proxy: %d <==> %d created", (int) client, (int) remote);
+    set_nonblock(client, 1);
+    set_nonblock(remote, 1);
+    return conn_create(client, remote);
+}
+
+#ifdef __linux__
+// Edge-triggered epoll: every event pumps both directions until the sockets
+// would block, so interest never has to change with backpressure. Data is
+// relayed by splice() through a pipe per direction and never passes through
+// user space.
+
+static void epoll_service(proxy_conn *c, bool error,
+    std::vector<proxy_conn*> &ready, std::vector<proxy_conn*> &closing)
+{
+    if (c->closed)
+        return;
+
+    if (error || !conn_service(c)) {
+        c->closed = true;
+        closing.push_back(c);
+    }
+    else if (c->more) {
+        ready.push_back(c);
+    }
+}
+
 void* proxy_run(void *data) {
-    fd_set set;
     std::deque<struct proxy_conn*> list;
+    std::vector<struct proxy_conn*> ready, again, closing;
+    struct epoll_event events[PROXY_MAX_EVENTS];
+    struct epoll_event ev;
     Proxy *proxy = (Proxy*) data;
 
-    auto buffer = (uint8_t*) bmalloc(BUF_SIZE);
-    FD_ZERO(&set);
-
     vlog("proxy thread active: port=%d", proxy->port_local);
 
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        elog("proxy: epoll_create1 failed (%d): %s", errno, strerror(errno));
+        return 0;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, proxy->proxy_sock, &ev);
+
     while (proxy->thread_active) {
-        socket_t client = net_accept(proxy->proxy_sock);
-
-        if (client != INVALID_SOCKET) {
-            // todo: make connect function generic, usbmux hacked in here for now
-            #ifdef _WIN32
-            auto usbmux = (USBMux*) proxy->discovery_mgr;
-            int rc = usbmux->usbmuxd_connect(
-                (uint32_t) proxy->proxy_device->handle,
-                (short) proxy->port_remote);
-
-            #elif __linux__
-            int rc = usbmuxd_connect(
-                (uint32_t) proxy->proxy_device->handle,
-                (short) proxy->port_remote);
-
-            #elif __APPLE__
-            int rc = net_connect(
-                (const char*) proxy->proxy_device->address,
-                proxy->port_remote);
-
-            #else
-            #error Unknown System
-            #endif
+        int rc = epoll_wait(epfd, events, PROXY_MAX_EVENTS, ready.empty() ? PROXY_WAIT_MS : 0);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
 
-            if (rc > 0) {
-                socket_t remote = rc;
-                vlog("proxy: %llu <==> %llu created", client, remote);
-                set_nonblock(remote, 1);
-                set_recv_timeout(remote, 1);
-                list.push_back(new proxy_conn(client, remote));
+            elog("proxy epoll_wait failed (%d): %s", errno, strerror(errno));
+            os_sleep_ms(5);
+            continue;
+        }
 
-                FD_SET(client, &set);
-                FD_SET(remote, &set);
-            }
-            else {
-                elog("proxy: remote connection failed");
-                net_close(client);
+        again.swap(ready);
+        for (int i = 0; i < rc; i++) {
+            proxy_conn *c = (proxy_conn*) events[i].data.ptr;
+            if (c == NULL) {
+                while ((c = proxy_accept(proxy)) != NULL) {
+                    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                    ev.data.ptr = c;
+                    if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->client, &ev) != 0
+                        || epoll_ctl(epfd, EPOLL_CTL_ADD, c->remote, &ev) != 0)
+                    {
+                        elog("proxy: epoll_ctl failed (%d): %s", errno, strerror(errno));
+                        c->closed = true;
+                        closing.push_back(c);
+                    }
+                    list.push_back(c);
+                }
+                continue;
             }
+
+            epoll_service(c, (events[i].events & EPOLLERR) != 0, ready, closing);
         }
 
-        if (list.size() == 0) {
-            os_sleep_ms(5);
-            continue;
+        for (auto c : again)
+            epoll_service(c, false, ready, closing);
+        again.clear();
+
+        // freed last, the batch may hold more events for them
+        for (auto c : closing) {
+            epoll_ctl(epfd, EPOLL_CTL_DEL, c->client, NULL);
+            epoll_ctl(epfd, EPOLL_CTL_DEL, c->remote, NULL);
+            ready.erase(std::remove(ready.begin(), ready.end(), c), ready.end());
+            list.erase(std::find(list.begin(), list.end(), c));
+            conn_free(c);
         }
+        closing.clear();
+    } // while(active)
 
-        fd_set read_fds = set;
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 256000;
-        int rc = select(FD_SETSIZE, &read_fds, NULL, NULL, &timeout);
-        if (rc == 0)
-            continue;
+    while (list.size()) {
+        conn_free(list.back());
+        list.pop_back();
+    }
+
+    close(epfd);
+    vlog("proxy thread end");
+    return 0;
+}
+
+#else
+// poll() everywhere else (WSAPoll on Windows), relaying through a buffer
+// per direction. A socket is only polled for what it can do next: read while
+// its outgoing half holds nothing, write while the other half holds data.
+
+static short poll_events(proxy_conn *c, int side) {
+    const proxy_half *in  = &c->half[side];     // read from this socket
+    const proxy_half *out = &c->half[side ^ 1]; // written to this socket
+    short events = 0;
+    if (in->pending == 0 && !in->eof)
+        events |= POLLIN;
+    if (out->pending > 0)
+        events |= POLLOUT;
+    return events;
+}
+
+void* proxy_run(void *data) {
+    std::deque<struct proxy_conn*> list;
+    std::vector<struct pollfd> fds;
+    Proxy *proxy = (Proxy*) data;
+    bool more = false;
 
+    vlog("proxy thread active: port=%d", proxy->port_local);
+
+    while (proxy->thread_active) {
+        fds.resize(1 + list.size() * 2);
+        fds[0].fd = proxy->proxy_sock;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+
+        size_t n = 1;
+        for (auto c : list) {
+            for (int side = 0; side < 2; side++, n++) {
+                // with nothing to wait for, leave the socket out: a hung up
+                // peer would otherwise report POLLHUP on every call
+                fds[n].events = poll_events(c, side);
+                fds[n].fd = fds[n].events ? (side == 0 ? c->client : c->remote) : (socket_t) -1;
+                fds[n].revents = 0;
+            }
+        }
+
+        int rc = poll(fds.data(), (unsigned long) fds.size(), more ? 0 : PROXY_WAIT_MS);
         if (rc < 0) {
             WSAErrno();
-            elog("proxy select failed (%d): %s", errno, strerror(errno));
+            elog("proxy poll failed (%d): %s", errno, strerror(errno));
             os_sleep_ms(5);
             continue;
         }
 
-        vlog("select: %d read_fds", rc);
-
-        //auto size = list.size();
+        more = false;
+        n = 1;
         auto i = std::begin(list);
         while (i != std::end(list)) {
-            int err = 0;
-            auto elem = *i;
-
-            if (FD_ISSET(elem->client, &read_fds)) {
-                ssize_t r =         net_recv (elem->client, buffer, BUF_SIZE);
-                ssize_t s = r > 0 ? net_send_all(elem->remote, buffer, r) : 0;
-                if (r <= 0 || s <= 0) err = 1;
-                vlog("proxy: %llu  ==> %llu // r=%ld s=%ld err=%d",
-                    elem->client, elem->remote, r, s, err);
-            }
+            proxy_conn *c = *i;
+            const int revents = fds[n].revents | fds[n + 1].revents;
+            n += 2;
 
-            if (FD_ISSET(elem->remote, &read_fds)) {
-                ssize_t r =         net_recv (elem->remote, buffer, BUF_SIZE);
-                ssize_t s = r > 0 ? net_send_all(elem->client, buffer, r) : 0;
-                if (r <= 0 || s <= 0) err = 1;
-                vlog("proxy: %llu <==  %llu // r=%ld s=%ld err=%d",
-                    elem->client, elem->remote, r, s, err);
+            if (revents == 0 && !c->more) {
+                i++;
+                continue;
             }
 
-            if (err) {
-                vlog("proxy: %llu <==> %llu close", elem->client, elem->remote);
+            if ((revents & (POLLERR | POLLNVAL)) || !conn_service(c)) {
                 i = list.erase(i);
-                net_close(elem->client);
-                net_close(elem->remote);
-                FD_CLR(elem->client, &set);
-                FD_CLR(elem->remote, &set);
-                delete elem;
+                conn_free(c);
+                continue;
             }
-            else i++;
+
+            more |= c->more;
+            i++;
         }
 
-        /*if (size != list.size()) {
-            maxfd = 0;
-            for (auto elem : list) {
-                if (elem->client > maxfd) maxfd = elem->client;
-                if (elem->remote > maxfd) maxfd = elem->remote;
-            }
-        }*/
+        if (fds[0].revents & POLLIN) {
+            proxy_conn *c;
+            while ((c = proxy_accept(proxy)) != NULL)
+                list.push_back(c);
+        }
     } // while(active)
 
-    bfree(buffer);
     while (list.size()) {
-        auto elem = (struct proxy_conn *) list.back();
-        vlog("proxy: %llu <==> %llu close", elem->client, elem->remote);
-        net_close(elem->client);
-        net_close(elem->remote);
+        conn_free(list.back());
         list.pop_back();
-        delete elem;
     }
 
     vlog("proxy thread end");
     return 0;
 }
+#endif
@@ -0,0 +1,249 @@
+/*
+Copyright (C) 2025 DEV47APPS, github.com/dev47apps
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "plugin.h"
+#include "reactor.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <util/platform.h>
+
+#define REACTOR_MAX_THREADS 8
+#define REACTOR_EVENTS (EPOLLIN | EPOLLRDHUP | EPOLLONESHOT)
+
+static std::mutex lock;
+static std::condition_variable idle; // a removed stream's handler returned
+static std::map<uint64_t, ReactorStream*> streams;
+static std::vector<pthread_t> threads;
+static uint64_t next_id = 1;
+static int epfd = -1;
+static int stopfd = -1; // eventfd, readable once the reactor is freed
+static bool stop;
+
+static void *reactor_thread(void *) {
+    os_set_thread_name("droidcam-reactor");
+    struct epoll_event ev;
+
+    while (1) {
+        int n = epoll_wait(epfd, &ev, 1, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            elog("reactor: epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        if (n == 0)
+            continue;
+
+        // stopfd stays readable, so every thread sees it
+        if (ev.data.u64 == 0)
+            break;
+
+        ReactorStream *s;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = streams.find(ev.data.u64);
+            if (it == streams.end())
+                continue; // removed after the event was queued
+
+            s = it->second;
+            s->running = true;
+        }
+
+        // charged to the stream, so sources can report what their sockets cost
+        const uint64_t cpu_start = get_thread_cpu_ns();
+        const bool ok = !(ev.events & EPOLLERR) && s->on_readable(s->data);
+        s->cpu_ns += get_thread_cpu_ns() - cpu_start;
+        s->last_ts = os_gettime_ns();
+
+        std::lock_guard<std::mutex> guard(lock);
+        s->running = false;
+        if (s->id == 0) {
+            idle.notify_all();
+        }
+        else if (!ok) {
+            // left disarmed until the owner removes it
+            s->failed = true;
+            os_event_signal(s->wake);
+        }
+        else {
+            ev.events = REACTOR_EVENTS;
+            ev.data.u64 = s->id;
+            if (epoll_ctl(epfd, EPOLL_CTL_MOD, s->sock, &ev) < 0) {
+                elog("reactor: re-arm failed: %s", strerror(errno));
+                s->failed = true;
+                os_event_signal(s->wake);
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Called with the lock held
+static bool start_reactor(void) {
+    if (epfd >= 0)
+        return !stop;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        elog("reactor: epoll_create1 failed: %s", strerror(errno));
+        return false;
+    }
+
+    stopfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (stopfd < 0) {
+        elog("reactor: eventfd failed: %s", strerror(errno));
+        close(epfd);
+        epfd = -1;
+        return false;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = 0;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, stopfd, &ev);
+    stop = false;
+    ilog("reactor start");
+    return true;
+}
+
+bool reactor_available(void) {
+    static std::atomic_bool logged(false);
+    if (getenv("DROIDCAM_DISABLE_REACTOR") == NULL)
+        return true;
+
+    if (!logged.exchange(true))
+        ilog("reactor disabled by DROIDCAM_DISABLE_REACTOR, receiving on source threads");
+
+    return false;
+}
+
+bool reactor_add(ReactorStream *stream) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!start_reactor())
+        return false;
+
+    stream->id = next_id++;
+    stream->running = false;
+    stream->failed = false;
+    stream->last_ts = os_gettime_ns();
+
+    struct epoll_event ev;
+    ev.events = REACTOR_EVENTS;
+    ev.data.u64 = stream->id;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, stream->sock, &ev) < 0) {
+        elog("reactor: epoll_ctl(ADD, %d) failed: %s", stream->sock, strerror(errno));
+        stream->id = 0;
+        return false;
+    }
+
+    streams[stream->id] = stream;
+
+    // A thread per stream up to the core count: streams from many sources
+    // spread over the cores, a single source does not park idle threads.
+    int max_threads = os_get_logical_cores();
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > REACTOR_MAX_THREADS) max_threads = REACTOR_MAX_THREADS;
+
+    if (threads.size() < streams.size() && (int) threads.size() < max_threads) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, reactor_thread, NULL) == 0) {
+            threads.push_back(thread);
+            dlog("reactor: %d threads", (int) threads.size());
+        }
+        else if (threads.empty()) {
+            elog("Error creating reactor thread");
+            epoll_ctl(epfd, EPOLL_CTL_DEL, stream->sock, NULL);
+            streams.erase(stream->id);
+            stream->id = 0;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void reactor_remove(ReactorStream *stream) {
+    std::unique_lock<std::mutex> guard(lock);
+    if (stream->id) {
+        streams.erase(stream->id);
+        epoll_ctl(epfd, EPOLL_CTL_DEL, stream->sock, NULL);
+        stream->id = 0;
+    }
+
+    while (stream->running)
+        idle.wait(guard);
+}
+
+void reactor_free(void) {
+    std::vector<pthread_t> joined;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (epfd < 0)
+            return;
+
+        stop = true;
+        uint64_t one = 1;
+        if (write(stopfd, &one, sizeof(one)) < 0)
+            elog("reactor: eventfd write failed: %s", strerror(errno));
+
+        joined.swap(threads);
+    }
+
+    for (pthread_t thread : joined)
+        pthread_join(thread, NULL);
+
+    std::lock_guard<std::mutex> guard(lock);
+    streams.clear();
+    close(stopfd);
+    close(epfd);
+    stopfd = epfd = -1;
+    ilog("reactor end");
+}
+
+#else
+
+bool reactor_available(void) {
+    static std::atomic_bool logged(false);
+    if (!logged.exchange(true))
+        ilog("no reactor on this platform, receiving on source threads");
+
+    return false;
+}
+
+bool reactor_add(ReactorStream *) {
+    return false;
+}
+
+void reactor_remove(ReactorStream *) {
+}
+
+void reactor_free(void) {
+}
+
+#endif
@@ -0,0 +1,55 @@
+// Copyright (C) 2025 DEV47APPS, github.com/dev47apps
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <util/threading.h>
+#include "net.h"
+
+// A non-blocking socket serviced by the reactor.
+// `on_readable` runs on a reactor thread whenever `sock` has data, never
+// concurrently with itself. It returns false when the stream is done
+// (closed, or an error), after which `failed` is set, `wake` is signaled
+// and the socket is no longer polled until removed.
+struct ReactorStream {
+    socket_t sock;
+    uint64_t id; // 0 = not registered
+    bool running;
+    std::atomic_bool failed;
+    std::atomic<uint64_t> last_ts; // last time on_readable ran
+    std::atomic<uint64_t> cpu_ns;  // reactor thread CPU spent in on_readable, across connections
+    os_event_t *wake;
+
+    bool (*on_readable)(void *data);
+    void *data;
+
+    ReactorStream(void) : sock(INVALID_SOCKET), id(0), running(false), failed(false),
+        last_ts(0), cpu_ns(0), wake(NULL), on_readable(NULL), data(NULL) {}
+};
+
+// Process-wide receive reactor.
+//
+// Instead of a thread blocked in recv() per socket, all registered sockets
+// share one epoll set and a small pool of worker threads (one per core, up
+// to the number of streams). Sockets are armed one-shot, so a stream is
+// only ever handled by one worker at a time and needs no locking of its own.
+//
+// Only receiving and frame parsing run here. Connecting, the stream requests,
+// reconnect supervision, comms and decoding stay on each source's own
+// threads, which block on their wake event while the socket is serviced
+// here. The pool comes on top of those, so the thread count still grows
+// with the number of sources.
+//
+// Only available where epoll is (Linux), and unless DROIDCAM_DISABLE_REACTOR
+// is set. Otherwise reactor_available() logs why, once, and returns false,
+// and callers keep their blocking receive loop.
+bool reactor_available(void);
+
+// Start servicing `stream`. Returns false if it could not be registered.
+bool reactor_add(ReactorStream *stream);
+
+// Stop servicing `stream`, waiting for a running on_readable() to return.
+// After this the socket can be closed and the handler's data released.
+void reactor_remove(ReactorStream *stream);
+
+void reactor_free(void);
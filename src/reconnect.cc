@@ -0,0 +1,292 @@
+/*
+Copyright (C) 2025 DEV47APPS, github.com/dev47apps
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <string.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#include "plugin.h"
+#include "source.h"
+#include "net.h"
+#include "device_discovery.h"
+#include "reconnect.h"
+
+#define REFRESH_MIN_MS  1000
+#define REFRESH_MAX_MS  30000
+#define SCHEDULER_IDLE_MS 10000
+
+enum {
+    DISCOVERY_MDNS,
+    DISCOVERY_ADB,
+    DISCOVERY_IOS,
+    DISCOVERY_COUNT,
+};
+
+static const char* DiscoveryNames[DISCOVERY_COUNT] = {
+    "mdns", "adb", "usbmux",
+};
+
+struct Discovery {
+    DeviceDiscovery *mgr;        // scheduler thread only
+    std::vector<Device> devices; // last refresh
+    Backoff backoff;
+    uint64_t last_ts;            // last refresh, 0 = never
+    uint64_t next_ts;            // earliest next refresh
+
+    Discovery(void) : mgr(NULL), backoff(REFRESH_MIN_MS, REFRESH_MAX_MS), last_ts(0), next_ts(0) {}
+};
+
+struct ReconnectScheduler {
+    Discovery discovery[DISCOVERY_COUNT];
+    std::vector<ReconnectWaiter*> waiters;
+    os_event_t *signal;
+    pthread_t thread;
+    bool stop;
+};
+
+static std::mutex lock;
+static ReconnectScheduler *scheduler;
+
+static int discovery_index(DeviceType type) {
+    switch (type) {
+        case DeviceType::MDNS: return DISCOVERY_MDNS;
+        case DeviceType::ADB:  return DISCOVERY_ADB;
+        case DeviceType::IOS:  return DISCOVERY_IOS;
+        case DeviceType::WIFI:
+        case DeviceType::NONE:
+            break;
+    }
+    return -1;
+}
+
+static int device_index(const std::vector<Device> &devices, const char *id) {
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (strncmp(devices[i].serial, id, sizeof(Device::serial)) == 0)
+            return (int) i;
+    }
+    return -1;
+}
+
+static DeviceDiscovery *create_mgr(int index) {
+    switch (index) {
+        case DISCOVERY_MDNS: return new MDNS();
+        case DISCOVERY_ADB:  return new AdbMgr();
+        case DISCOVERY_IOS:  return new USBMux();
+    }
+    return NULL;
+}
+
+// Called with the lock held: a type needs refreshing while anyone waits on it
+static bool wanted(int index) {
+    for (ReconnectWaiter *w : scheduler->waiters) {
+        if (w->waiting && discovery_index(w->type) == index)
+            return true;
+    }
+    return false;
+}
+
+static void refresh(int index) {
+    Discovery *d = &scheduler->discovery[index];
+    std::vector<Device> devices;
+    Device *dev;
+
+    #ifdef DEBUG
+    const uint64_t start = os_gettime_ns();
+    #endif
+    d->mgr->Reload();
+    d->mgr->ResetIter();
+    while ((dev = d->mgr->NextDevice()) != NULL)
+        devices.push_back(*dev);
+
+    std::lock_guard<std::mutex> guard(lock);
+    bool returned = false;
+    int woken = 0;
+    for (ReconnectWaiter *w : scheduler->waiters) {
+        if (!w->waiting || discovery_index(w->type) != index)
+            continue;
+
+        // Only a device that (re)appeared is news. One that stays listed
+        // but refuses connections is retried on the source's own backoff.
+        if (device_index(devices, w->id) < 0 || device_index(d->devices, w->id) >= 0)
+            continue;
+
+        ilog("reconnect: %s device %s is back", DiscoveryNames[index], w->id);
+        returned = true;
+        w->waiting = false;
+        for (int i = 0; i < 2; i++)
+            if (w->wake[i]) os_event_signal(w->wake[i]);
+        woken ++;
+    }
+
+    // A device coming back is worth checking for the next one quickly,
+    // anything else (still missing, or present but refusing) backs off.
+    // This is the only place the backoff is reset.
+    if (returned)
+        d->backoff.reset();
+
+    const uint64_t now = os_gettime_ns();
+    const int delay_ms = d->backoff.next();
+    d->devices.swap(devices);
+    d->last_ts = now;
+    d->next_ts = now + (uint64_t) delay_ms * 1000000;
+
+    dlog("reconnect: %s refresh took %dms, %d devices, woke %d sources, next in %dms",
+        DiscoveryNames[index], (int) ((now - start) / 1000000),
+        (int) d->devices.size(), woken, delay_ms);
+}
+
+static void *scheduler_thread(void *) {
+    ilog("reconnect scheduler start");
+    os_set_thread_name("droidcam-reconnect");
+
+    while (1) {
+        int due = -1;
+        uint64_t wait_ns = (uint64_t) SCHEDULER_IDLE_MS * 1000000;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (scheduler->stop)
+                break;
+
+            const uint64_t now = os_gettime_ns();
+            for (int i = 0; i < DISCOVERY_COUNT; i++) {
+                if (!wanted(i))
+                    continue;
+
+                const uint64_t next_ts = scheduler->discovery[i].next_ts;
+                if (next_ts <= now) {
+                    due = i;
+                    break;
+                }
+
+                if (next_ts - now < wait_ns)
+                    wait_ns = next_ts - now;
+            }
+        }
+
+        if (due >= 0) {
+            Discovery *d = &scheduler->discovery[due];
+            if (!d->mgr)
+                d->mgr = create_mgr(due);
+
+            refresh(due);
+            continue;
+        }
+
+        os_event_timedwait(scheduler->signal, (unsigned long) (wait_ns / 1000000) + 1);
+    }
+
+    ilog("reconnect scheduler end");
+    return 0;
+}
+
+// Called with the lock held
+static bool start_scheduler(void) {
+    if (scheduler)
+        return true;
+
+    ReconnectScheduler *s = new ReconnectScheduler();
+    if (os_event_init(&s->signal, OS_EVENT_TYPE_AUTO) != 0) {
+        delete s;
+        return false;
+    }
+
+    s->stop = false;
+    scheduler = s;
+    if (pthread_create(&s->thread, NULL, scheduler_thread, NULL) != 0) {
+        elog("Error creating reconnect scheduler thread");
+        os_event_destroy(s->signal);
+        delete s;
+        scheduler = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+bool reconnect_find(DeviceType type, const char *id, Device *out, int *index) {
+    const int di = discovery_index(type);
+    std::lock_guard<std::mutex> guard(lock);
+    if (di < 0 || !scheduler)
+        return false;
+
+    const std::vector<Device> &devices = scheduler->discovery[di].devices;
+    const int i = device_index(devices, id);
+    if (i < 0)
+        return false;
+
+    *out = devices[i];
+    if (index) *index = i;
+    return true;
+}
+
+void reconnect_wait(ReconnectWaiter *waiter, DeviceType type, const char *id) {
+    const int di = discovery_index(type);
+    if (di < 0)
+        return;
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (!start_scheduler())
+        return;
+
+    // Waiters share whatever refresh is scheduled for the type, also the
+    // first one: a source woken for its device that then fails to connect
+    // must not restart the backoff.
+    if (std::find(scheduler->waiters.begin(), scheduler->waiters.end(), waiter) == scheduler->waiters.end())
+        scheduler->waiters.push_back(waiter);
+
+    waiter->type = type;
+    snprintf(waiter->id, sizeof(waiter->id), "%s", id);
+    waiter->waiting = true;
+    os_event_signal(scheduler->signal);
+}
+
+void reconnect_cancel(ReconnectWaiter *waiter) {
+    std::lock_guard<std::mutex> guard(lock);
+    waiter->waiting = false;
+    if (!scheduler)
+        return;
+
+    std::vector<ReconnectWaiter*> &waiters = scheduler->waiters;
+    waiters.erase(std::remove(waiters.begin(), waiters.end(), waiter), waiters.end());
+}
+
+void reconnect_scheduler_free(void) {
+    ReconnectScheduler *s;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        s = scheduler;
+        if (!s)
+            return;
+
+        s->stop = true;
+        os_event_signal(s->signal);
+    }
+
+    pthread_join(s->thread, NULL);
+
+    std::lock_guard<std::mutex> guard(lock);
+    for (int i = 0; i < DISCOVERY_COUNT; i++) {
+        if (s->discovery[i].mgr)
+            delete s->discovery[i].mgr;
+    }
+
+    os_event_destroy(s->signal);
+    delete s;
+    scheduler = NULL;
+}
@@ -0,0 +1,62 @@
+// Copyright (C) 2025 DEV47APPS, github.com/dev47apps
+#pragma once
+
+#include <stdint.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+// Jittered exponential backoff for a single retry loop.
+// Each next() doubles the delay up to max_ms, randomized by +/-25% so
+// sources that failed together do not retry in lockstep.
+struct Backoff {
+    int min_ms;
+    int max_ms;
+    int delay_ms;
+    uint32_t seed;
+
+    Backoff(int min, int max) : min_ms(min), max_ms(max), delay_ms(min) {
+        seed = (uint32_t) (os_gettime_ns() ^ (uintptr_t) this) | 1;
+    }
+
+    void reset(void) { delay_ms = min_ms; }
+
+    int next(void) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        const int ms = delay_ms * 3 / 4 + (int) (seed % (uint32_t) (delay_ms / 2 + 1));
+        delay_ms = delay_ms * 2 > max_ms ? max_ms : delay_ms * 2;
+        return ms;
+    }
+};
+
+// A source waiting for its device to (re)appear in discovery.
+// Owned by the source; `wake` events are signaled once a refresh finds `id`.
+struct ReconnectWaiter {
+    os_event_t *wake[2];
+    DeviceType type;
+    char id[sizeof(Device::serial)];
+    bool waiting;
+};
+
+// Process-wide device discovery for reconnecting sources.
+//
+// Sources look devices up in shared snapshots instead of reloading their own
+// discovery managers. A source that cannot find (or reach) its device waits
+// on the scheduler: refreshes requested by any number of sources are merged
+// into one adb/usbmuxd/mDNS query per type, spaced by a shared, jittered
+// exponential backoff. The waiting sources are woken the moment a refresh
+// reports their device back.
+
+// Copy the last known device `id` of `type` into `out`. `index` receives its
+// position in the device list. Returns false if not known.
+bool reconnect_find(DeviceType type, const char *id, Device *out, int *index);
+
+// Wait for device `id` of `type`: schedules a refresh and signals the
+// waiter's events once the device is seen.
+void reconnect_wait(ReconnectWaiter *waiter, DeviceType type, const char *id);
+
+// Stop tracking `waiter`, e.g. when its source is destroyed
+void reconnect_cancel(ReconnectWaiter *waiter);
+
+void reconnect_scheduler_free(void);
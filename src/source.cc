@@ -15,6 +15,9 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <stdlib.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
 #include <util/threading.h>
 #include <util/platform.h>
 
@@ -36,12 +39,34 @@ extern QMainWindow *main_window;
 #include "ffmpeg_decode.h"
 #include "mjpeg_decode.h"
 #include "net.h"
-#include "buffer_util.h"
+#include "frame_reader.h"
+#include "http_client.h"
+#include "av_sync.h"
+#include "audio_jitter.h"
 #include "device_discovery.h"
+#include "reconnect.h"
+#include "reactor.h"
 
 #define FPS 25
 #define MILLI_SEC 1000
 #define NANO_SEC  1000000000
+#define IDLE_WAIT (MILLI_SEC * 10)
+#define RETRY_MIN_MS 250
+#define RETRY_MAX_MS (MILLI_SEC * 8)
+
+enum SourceThread {
+    THREAD_VIDEO,
+    THREAD_DECODE,
+    THREAD_AUDIO,
+    THREAD_COMMS,
+    THREAD_VIDEO_RX, // reactor time spent on the video socket
+    THREAD_AUDIO_RX, // same, audio socket (includes audio decode)
+    THREAD_COUNT,
+};
+
+static const char* SourceThreadNames[THREAD_COUNT] = {
+    "video", "decode", "audio", "comms", "video_rx", "audio_rx",
+};
 
 extern char os_name_version[64];
 extern const char* bindIP;
@@ -53,12 +78,15 @@ struct droidcam_obs_source {
     AdbMgr adbMgr;
     USBMux iosMgr;
     MDNS mdnsMgr;
-    Decoder* video_decoder;
+    std::atomic<Decoder*> video_decoder;
     Decoder* audio_decoder;
     obs_source_t *source;
     os_event_t *stop_signal;
     os_event_t *reset_signal;
     os_event_t *comms_signal;
+    os_event_t *video_wake;
+    os_event_t *audio_wake;
+    os_event_t *decode_signal;
     pthread_t audio_thread;
     pthread_t video_thread;
     pthread_t video_decode_thread;
@@ -68,14 +96,41 @@ struct droidcam_obs_source {
     bool activated;
     bool deactivateWNS;
     bool enable_audio;
+    bool audio_only; // no video/decode threads, just audio and comms
+    bool video_thread_started;
+    bool decode_thread_started;
+    uint64_t thread_cpu_ns[THREAD_COUNT]; // written by each thread on exit, the _RX ones by video/audio
+    uint64_t video_bytes, audio_bytes;
+    uint64_t mode_ts; // when audio_only last changed
+    uint64_t mode_ns[2]; // time spent in audio+video [0] and audio only [1]
     bool use_hw;
     bool use_hdr;
+    bool scale_to_display;
+    bool sync_av;
+    bool use_audio_jitter;
     bool audio_running;
     bool video_running;
     int video_width, video_height;
-    int usb_port;
+    std::atomic<int> usb_port; // changed by connect(), reset on deactivate
+    std::mutex connect_lock; // video, audio and comms threads connect concurrently
+    int latency_budget_ms;
+    int recovery_limit;
+    int recovery_window_s;
+    enum DropPolicy drop_policy;
+    enum DecodeThreading decode_threading;
     enum VideoFormat video_format;
+    enum VideoFormat decoder_format; // format/size video_decoder was created for
+    int decoder_width, decoder_height;
+    bool decoder_warm;
+    bool connect_warm;
+    std::atomic<uint64_t> connect_ts; // for the connect-to-first-frame timer
+    std::atomic<uint64_t> audio_connect_ts; // same, for the first audio sample
+    int display_width, display_height; // largest size the source is shown at, 0 = full size
+    std::atomic<uint64_t> display_check_ts;
+    AVClock av_clock; // phone pts to host time, with sync_av
+    AudioJitter audio_jitter; // audio thread only
     struct active_device_info device_info;
+    ReconnectWaiter reconnect;
     struct obs_source_audio obs_audio_frame;
     struct obs_source_frame2 obs_video_frame;
     uint64_t time_start;
@@ -83,6 +138,9 @@ struct droidcam_obs_source {
     std::vector<OBSSignal> signal_handlers;
     #endif
     Queue<CommsTask> comms_queue;
+    // Video decoders retired by the video thread, deleted by the decode thread
+    std::mutex retired_lock;
+    std::vector<Decoder*> retired_decoders;
 };
 
 #if DROIDCAM_OVERRIDE
@@ -102,136 +160,198 @@ static void signal_source_update(obs_source_t* source, const char* battery_level
     os_event_signal(plugin->comms_signal);\
     } while(0)
 
-static socket_t connect(struct droidcam_obs_source *plugin) {
-    Device* dev;
+// Idle video/audio threads block on their wake event instead of polling;
+// signal them whenever activation, visibility or stream settings change.
+static inline void wake_threads(struct droidcam_obs_source *plugin) {
+    if (plugin->video_wake) os_event_signal(plugin->video_wake);
+    if (plugin->audio_wake) os_event_signal(plugin->audio_wake);
+}
+
+// Devices are looked up in the shared discovery snapshots (see reconnect.h).
+// When the device is missing or cannot be reached, the source waits on the
+// reconnect scheduler, which wakes it as soon as discovery sees it again.
+// `local_port`, if given, receives the ADB/iOS port the socket went through.
+static socket_t connect(struct droidcam_obs_source *plugin, int *local_port = NULL) {
+    Device device; // copy of the discovered device, iproxy keeps its own
+    Device* dev = &device;
     AdbMgr* adbMgr = &plugin->adbMgr;
     USBMux* iosMgr = &plugin->iosMgr;
-    MDNS  *mdnsMgr = &plugin->mdnsMgr;
+    int index = 0;
+    socket_t rc = INVALID_SOCKET;
 
     struct active_device_info *device_info = &plugin->device_info;
 
+    // usb_port and the ADB forwards are shared by the source's sockets
+    std::unique_lock<std::mutex> guard(plugin->connect_lock);
+
     dlog("connect device: id=%s type=%d", device_info->id, (int) device_info->type);
 
     if (device_info->type == DeviceType::WIFI) {
+        guard.unlock();
         return net_connect(device_info->ip, bindIP, device_info->port);
     }
 
-    if (device_info->type == DeviceType::MDNS) {
-        dev = mdnsMgr->GetDevice(device_info->id);
-        if (dev) {
-            return net_connect(dev->address, bindIP, device_info->port);
-        }
+    if (!reconnect_find(device_info->type, device_info->id, dev, &index))
+        goto out;
 
-        mdnsMgr->Reload();
+    if (device_info->type == DeviceType::MDNS) {
+        rc = net_connect(dev->address, bindIP, device_info->port);
         goto out;
     }
 
     if (device_info->type == DeviceType::ADB) {
-        dev = adbMgr->GetDevice(device_info->id);
-        if (dev) {
-            if (adbMgr->DeviceOffline(dev)) {
-                elog("device is offline...");
-                goto out;
-            }
-
-            int port_start = device_info->port + (adbMgr->Iter() * 10);
-            int port_last = port_start + 8;
-
-            if (plugin->usb_port < port_start) {
-                plugin->usb_port = port_start;
-            }
-            else if (plugin->usb_port > port_last) {
-                plugin->usb_port = port_start;
-                adbMgr->ClearForwards(port_start, port_last);
-            }
-
-            ilog("ADB: mapping %d -> %d [%s]", plugin->usb_port, device_info->port, device_info->id);
-            if (!adbMgr->AddForward(dev, plugin->usb_port, device_info->port)) {
-                plugin->usb_port++;
-                goto out;
-            }
+        if (adbMgr->DeviceOffline(dev)) {
+            elog("device is offline...");
+            goto out;
+        }
 
-            socket_t rc = net_connect(localhost_ip, plugin->usb_port);
-            if (rc != INVALID_SOCKET) return rc;
+        int port_start = device_info->port + (index * 10);
+        int port_last = port_start + 8;
 
+        if (plugin->usb_port < port_start) {
+            plugin->usb_port = port_start;
+        }
+        else if (plugin->usb_port > port_last) {
+            plugin->usb_port = port_start;
             adbMgr->ClearForwards(port_start, port_last);
+        }
+
+        ilog("ADB: mapping %d -> %d [%s]", plugin->usb_port.load(), device_info->port, device_info->id);
+        if (!adbMgr->AddForward(dev, plugin->usb_port, device_info->port)) {
+            plugin->usb_port++;
             goto out;
         }
 
-        adbMgr->Reload();
+        rc = net_connect(localhost_ip, plugin->usb_port);
+        if (rc == INVALID_SOCKET)
+            adbMgr->ClearForwards(port_start, port_last);
+
         goto out;
     }
 
     if (device_info->type == DeviceType::IOS) {
-        dev = iosMgr->GetDevice(device_info->id);
-        if (dev) {
-            return iosMgr->Connect(dev, device_info->port, &plugin->usb_port);
-        }
-
-        iosMgr->Reload();
+        int iproxy_port = plugin->usb_port;
+        rc = iosMgr->Connect(dev, device_info->port, &iproxy_port);
+        plugin->usb_port = iproxy_port;
         goto out;
     }
 
     out:
-    return INVALID_SOCKET;
+    if (local_port)
+        *local_port = plugin->usb_port;
+
+    guard.unlock();
+    if (rc == INVALID_SOCKET)
+        reconnect_wait(&plugin->reconnect, device_info->type, device_info->id);
+
+    return rc;
 }
 
 #define MAXCONFIG 1024
 #define MAXPACKET 1024 * 1024 * 16
+#define BACKLOG_CHECK_US 100000
+#define AUDIO_BACKLOG_RESUME_MS 50
+
+// After a stall, seconds of old media can sit in the socket. Once the
+// backlog goes over `backlog_budget_ms`, frames are skipped right out of the
+// socket: until a keyframe with the backlog back under budget (video), or
+// until the backlog is about gone (audio).
 static DataPacket*
-read_frame(Decoder *decoder, socket_t sock, int *has_config)
+read_frame(Decoder *decoder, FrameReader *reader, int *has_config,
+    uint32_t backlog_budget_ms, bool to_keyframe)
 {
-    uint8_t header[HEADER_SIZE];
     uint8_t config[MAXCONFIG];
-    size_t r;
-    size_t len, config_len = 0;
+    size_t config_len = 0;
+    uint32_t len;
     uint64_t pts;
 
     AGAIN:
-    r = net_recv_all(sock, header, HEADER_SIZE);
-    if (r != HEADER_SIZE) {
-        elog("read header timeout/error: got %ld expected %ld", r, HEADER_SIZE);
+    reader->waiting = reader->nonblocking && !reader->frame_ready();
+    if (reader->waiting)
+        return NULL;
+
+    if (!reader->read_header(&pts, &len)) {
+        elog("read header timeout/error");
         return NULL;
     }
 
-    pts = buffer_read64be(header);
-    len = buffer_read32be(&header[8]);
-    // dlog("read_frame: header: pts=%llu len=%ld", pts, len);
+    // dlog("read_frame: header: pts=%llu len=%u", pts, len);
 
-    if (len == NO_PTS) {
+    if (len == (uint32_t) NO_PTS) {
         elog("stop/error from app side");
         return NULL;
     }
 
     if (len == 0 || len > MAXPACKET) {
-        elog("read_frame: packet too large or empty at len=%ld", len);
+        elog("read_frame: packet too large or empty at len=%u", len);
         return NULL;
     }
 
     // no pts = config packet
     if (pts == NO_PTS) {
-        if (config_len != 0) {
+        if (config_len != 0 && !reader->skipping) {
              elog("double config ???");
              return NULL;
         }
 
         if (len > MAXCONFIG) {
-            elog("read_frame: config packet too large at %ld!", len);
+            elog("read_frame: config packet too large at %u!", len);
             return NULL;
         }
 
-        r = net_recv_all(sock, config, len);
-        if (r != len) {
-            elog("read_frame: config timeout/error: got %ld expected %ld", r, len);
+        if (!reader->read(config, len)) {
+            elog("read_frame: config timeout/error");
             return NULL;
         }
 
-        ilog("read_frame: got config: %ld", len);
+        ilog("read_frame: got config: %u", len);
         config_len = len;
         *has_config = 1;
         goto AGAIN;
     }
 
+    reader->track_rate(pts, len);
+
+    if (backlog_budget_ms && !reader->skipping
+        && (pts >= reader->backlog_check_pts + BACKLOG_CHECK_US || pts < reader->backlog_check_pts))
+    {
+        reader->backlog_check_pts = pts;
+        const uint32_t backlog = reader->backlog_ms();
+        if (backlog > backlog_budget_ms) {
+            dlog("read_frame: %ums backlog, skipping", backlog);
+            reader->skipping = true;
+        }
+    }
+
+    if (reader->skipping) {
+        const uint32_t backlog = reader->backlog_ms();
+        bool resume = backlog_budget_ms == 0;
+        if (!resume && to_keyframe) {
+            const size_t head_len = len < reader->size ? len : reader->size;
+            const uint8_t *head = reader->peek(head_len);
+            if (!head)
+                return NULL;
+
+            resume = backlog <= backlog_budget_ms && decoder->is_keyframe_data(head, head_len);
+        }
+        else if (!resume) {
+            resume = backlog <= AUDIO_BACKLOG_RESUME_MS;
+        }
+
+        if (!resume) {
+            if (!reader->skip(len))
+                return NULL;
+
+            reader->skipped_frames++;
+            reader->skipped_bytes += len;
+            decoder->drops[DROP_BACKLOG] ++;
+            goto AGAIN;
+        }
+
+        dlog("read_frame: resume at %ums backlog", backlog);
+        reader->skipping = false;
+    }
+
     DataPacket* data_packet = decoder->pull_empty_packet(config_len + len);
     uint8_t *p = data_packet->data;
     if (config_len) {
@@ -239,125 +359,396 @@ read_frame(Decoder *decoder, socket_t sock, int *has_config)
         p += config_len;
     }
 
-    r = net_recv_all(sock, p, len);
-    if (r != len) {
-        elog("read_frame: timeout/error: read %ld bytes wanted %ld", r, len);
-        decoder->push_empty_packet(data_packet);
+    if (!reader->read(p, len)) {
+        decoder->recycle_packet(data_packet);
         return NULL;
     }
 
+    reader->frames++;
+    data_packet->recv_ts = os_gettime_ns();
+    data_packet->generation = decoder->generation;
     data_packet->pts = pts;
     data_packet->used = config_len + len;
     return data_packet;
 }
 
+// Decode thread: decode one packet (or none, to pick up frames finished
+// asynchronously) and send every frame the decoder has ready to OBS.
+static void output_video_frames(droidcam_obs_source *plugin, Decoder *decoder, DataPacket* data_packet) {
+    bool got_output;
+
+    if (!decoder->decode_video(&plugin->obs_video_frame, data_packet, &got_output)) {
+        elog("error decoding video");
+        decoder->recover(os_gettime_ns());
+        return;
+    }
+
+    // frame threading can hand back more than one frame per packet
+    while (got_output) {
+        //if (flip) plugin->obs_video_frame.flip = !plugin->obs_video_frame.flip;
+        // frames the codec returned without a pts already carry host time
+        if (plugin->sync_av && decoder->frame_pts != NO_PTS) {
+            uint64_t ts = plugin->av_clock.map(AV_STREAM_VIDEO, decoder->frame_pts);
+            if (ts) {
+                plugin->obs_video_frame.timestamp = ts;
+                plugin->av_clock.output(AV_STREAM_VIDEO, ts, os_gettime_ns());
+            }
+        }
+
+        #if 0
+        dlog("output video: %dx%d %lu",
+            plugin->obs_video_frame.width,
+            plugin->obs_video_frame.height,
+            plugin->obs_video_frame.timestamp);
+        #endif
+        obs_source_output_video2(plugin->source, &plugin->obs_video_frame);
+
+        uint64_t connect_ts = plugin->connect_ts.exchange(0);
+        if (connect_ts)
+            ilog("video: first frame %.1fms after connect (%s decoder)",
+                (double) (os_gettime_ns() - connect_ts) / 1000000.0,
+                plugin->connect_warm ? "warm" : "cold");
+
+        if (!decoder->decode_video(&plugin->obs_video_frame, NULL, &got_output)) {
+            elog("error decoding video");
+            decoder->recover(os_gettime_ns());
+            break;
+        }
+    }
+}
+
+// Decode thread: delete the decoders the video thread is done with.
+// Only this thread may be inside a video decoder, so it is the one place
+// where nothing can still be using them.
+static void release_retired_decoders(droidcam_obs_source *plugin) {
+    std::vector<Decoder*> retired;
+    {
+        std::lock_guard<std::mutex> guard(plugin->retired_lock);
+        retired.swap(plugin->retired_decoders);
+    }
+
+    for (Decoder *decoder : retired) {
+        dlog("release video_decoder");
+        decoder->flush();
+        delete decoder;
+    }
+}
+
+// Decode thread: open the codec on the first packet. The hw device probe
+// can take a while, and only holds up this source's own decoding.
+static void init_video_decoder(droidcam_obs_source *plugin, Decoder *decoder) {
+    bool init;
+    dlog("init video decoder");
+
+    if (plugin->decoder_format == FORMAT_AVC) {
+        init = (((FFMpegDecoder*)decoder)->init(NULL, AV_CODEC_ID_H264, plugin->use_hw) >= 0);
+    }
+    else if (plugin->decoder_format == FORMAT_HEVC) {
+        init = (((FFMpegDecoder*)decoder)->init(NULL, AV_CODEC_ID_H265, plugin->use_hw) >= 0);
+    }
+    else if (plugin->decoder_format == FORMAT_MJPG) {
+        ((MJpegDecoder*)decoder)->output_signal = plugin->decode_signal;
+        init = ((MJpegDecoder*)decoder)->init();
+    }
+    else {
+        init = false;
+    }
+
+    plugin->obs_video_frame.format = VIDEO_FORMAT_NONE;
+    plugin->obs_video_frame.range  = VIDEO_RANGE_DEFAULT;
+    if (init) {
+        comms_task(CommsTask::TALLY);
+        droidcam_signal(plugin->source, "droidcam_connect");
+    } else {
+        elog("could not initialize decoder");
+        decoder->failed = true;
+    }
+}
+
 static void *video_decode_thread(void *data) {
     droidcam_obs_source *plugin = (droidcam_obs_source*)(data);
 
     Decoder *decoder = NULL;
     DataPacket* data_packet = NULL;
-    bool got_output;
 
     ilog("video_decode_thread start");
 
     while (SOURCE_EXISTS()) {
+        release_retired_decoders(plugin);
+
         if ((decoder = plugin->video_decoder) == NULL || (data_packet = decoder->pull_ready_packet()) == NULL) {
-            os_sleep_ms(5);
+            // frames from decoder worker threads, or hand their packets back if failed
+            if (decoder && decoder->holds_packets()) {
+                if (decoder->failed)
+                    decoder->flush();
+                else
+                    output_video_frames(plugin, decoder, NULL);
+            }
+
+            // woken by recv_video_frame() for every queued packet,
+            // by decoder workers, or on destroy
+            os_event_timedwait(plugin->decode_signal, IDLE_WAIT);
             continue;
         }
 
-        if (decoder->failed)
-            goto LOOP;
+        decoder->track_wait(data_packet, os_gettime_ns());
 
-        if (!decoder->decode_video(&plugin->obs_video_frame, data_packet, &got_output)) {
-            elog("error decoding video");
-            decoder->failed = true;
+        if (!decoder->ready && !decoder->failed)
+            init_video_decoder(plugin, decoder);
+
+        if (decoder->failed) {
+            decoder->drops[DROP_DECODER_FAILED] ++;
             goto LOOP;
         }
 
-        if (got_output) {
-            plugin->obs_video_frame.timestamp = data_packet->pts * 1000;
-            //if (flip) plugin->obs_video_frame.flip = !plugin->obs_video_frame.flip;
-            #if 0
-            dlog("output video: %dx%d %lu",
-                plugin->obs_video_frame.width,
-                plugin->obs_video_frame.height,
-                plugin->obs_video_frame.timestamp);
-            #endif
-            obs_source_output_video2(plugin->source, &plugin->obs_video_frame);
-        }
+        if (decoder->check_generation(data_packet))
+            goto LOOP;
+
+        if (decoder->drop_late_packet(data_packet, os_gettime_ns()))
+            goto LOOP;
+
+        output_video_frames(plugin, decoder, data_packet);
+        if (decoder->holds_packets())
+            continue;
 
         LOOP:
         decoder->push_empty_packet(data_packet);
     }
 
+    release_retired_decoders(plugin);
+    plugin->thread_cpu_ns[THREAD_DECODE] = get_thread_cpu_ns();
     ilog("video_decode_thread end");
     return NULL;
 }
 
+struct display_size {
+    obs_source_t *source;
+    float aspect;
+    int width, height;
+    bool full_size;
+};
+
+// Required decode size for one scene item. Only bounded items keep their
+// on-screen size when the source resolution changes, and crop is given in
+// source pixels, so anything else needs the full frame.
+static void item_display_size(obs_sceneitem_t *item, struct display_size *size) {
+    struct obs_sceneitem_crop crop;
+    obs_sceneitem_get_crop(item, &crop);
+    if (crop.left || crop.top || crop.right || crop.bottom) {
+        size->full_size = true;
+        return;
+    }
+
+    vec2 bounds;
+    obs_sceneitem_get_bounds(item, &bounds);
+    int w, h;
+    switch (obs_sceneitem_get_bounds_type(item)) {
+        case OBS_BOUNDS_STRETCH:
+            w = (int) bounds.x;
+            h = (int) bounds.y;
+            break;
+        case OBS_BOUNDS_SCALE_INNER:
+            if (bounds.x > bounds.y * size->aspect) {
+                w = 0;
+                h = (int) bounds.y;
+            } else {
+                w = (int) bounds.x;
+                h = 0;
+            }
+            break;
+        case OBS_BOUNDS_SCALE_OUTER:
+            w = (int) std::max(bounds.x, bounds.y * size->aspect);
+            h = (int) std::max(bounds.y, bounds.x / size->aspect);
+            break;
+        case OBS_BOUNDS_SCALE_TO_WIDTH:
+            w = (int) bounds.x;
+            h = 0;
+            break;
+        case OBS_BOUNDS_SCALE_TO_HEIGHT:
+            w = 0;
+            h = (int) bounds.y;
+            break;
+        default:
+            size->full_size = true;
+            return;
+    }
+
+    if (w > size->width) size->width = w;
+    if (h > size->height) size->height = h;
+}
+
+static bool enum_display_items(obs_scene_t*, obs_sceneitem_t *item, void *data) {
+    struct display_size *size = (struct display_size*) data;
+    if (obs_sceneitem_is_group(item)) {
+        obs_sceneitem_group_enum_items(item, enum_display_items, data);
+    }
+    else if (obs_sceneitem_get_source(item) == size->source) {
+        item_display_size(item, size);
+    }
+
+    return !size->full_size;
+}
+
+// Find the largest size the source is drawn at across all scenes,
+// so the MJPEG decoder can skip resolution nobody sees.
+static void update_display_size(droidcam_obs_source *plugin) {
+    struct display_size size = {0};
+    size.source = plugin->source;
+    size.aspect = (float) plugin->video_width / (float) plugin->video_height;
+
+    obs_enum_scenes([](void *data, obs_source_t *scene_source) {
+        obs_scene_t *scene = obs_scene_from_source(scene_source);
+        if (scene)
+            obs_scene_enum_items(scene, enum_display_items, data);
+
+        return !((struct display_size*) data)->full_size;
+    }, &size);
+
+    if (size.full_size || (size.width == 0 && size.height == 0)) {
+        size.width = 0;
+        size.height = 0;
+    }
+
+    if (size.width != plugin->display_width || size.height != plugin->display_height) {
+        ilog("display size %dx%d (0 = full size)", size.width, size.height);
+        plugin->display_width = size.width;
+        plugin->display_height = size.height;
+    }
+}
+
 static bool
-recv_video_frame(droidcam_obs_source *plugin, socket_t sock) {
+recv_video_frame(droidcam_obs_source *plugin, FrameReader *reader) {
     int has_config = 0;
     DataPacket* data_packet;
     Decoder *decoder = plugin->video_decoder;
+    if (!decoder)
+        return false;
 
-    if (!decoder) {
-        if (plugin->video_format == FORMAT_MJPG) {
-            decoder = new MJpegDecoder();
-        }
-        else {
-            decoder = new FFMpegDecoder();
-        }
-        plugin->video_decoder = decoder;
-    }
-
-    data_packet = read_frame(decoder, sock, &has_config);
+    const uint32_t backlog_budget_ms = (plugin->drop_policy == DROP_NEVER) ? 0 : plugin->latency_budget_ms;
+    data_packet = read_frame(decoder, reader, &has_config, backlog_budget_ms, true);
     if (!data_packet)
         return false;
 
+    if (plugin->sync_av)
+        plugin->av_clock.observe(AV_STREAM_VIDEO, data_packet->pts, os_gettime_ns());
+
     // NOTE: data_packet must be properly disposed from here
 
-    // Decoder failures should not happen generally.
-    // Rather than causing a connection reset, just idle
+    // A decoder that could not recover from errors gets a fresh connection.
+    // One that could not initialize won't do better next time, so just idle.
     if (decoder->failed) {
-        FAILED:
+        if (decoder->ready) {
+            decoder->recycle_packet(data_packet);
+            return false;
+        }
+
         dlog("discarding frame.. decoder failed");
-        decoder->push_empty_packet(data_packet);
+        decoder->drops[DROP_DECODER_FAILED] ++;
+        decoder->recycle_packet(data_packet);
         return true;
     }
 
+    if (decoder->ready && plugin->decoder_warm) {
+        plugin->decoder_warm = false;
+        comms_task(CommsTask::TALLY);
+        droidcam_signal(plugin->source, "droidcam_connect");
+    }
 
-    if (!decoder->ready) {
-        bool init = false;
-        bool use_hw = plugin->use_hw;
-        dlog("init video decoder");
-
-        if (plugin->video_format == FORMAT_AVC) {
-            init = (((FFMpegDecoder*)decoder)->init(NULL, AV_CODEC_ID_H264, use_hw) >= 0);
-        }
-        else if (plugin->video_format == FORMAT_HEVC) {
-            init = (((FFMpegDecoder*)decoder)->init(NULL, AV_CODEC_ID_H265, use_hw) >= 0);
-        }
-        else if (plugin->video_format == FORMAT_MJPG) {
-            init = ((MJpegDecoder*)decoder)->init();
-        }
-        else {
-            init = false;
-        }
-
-        plugin->obs_video_frame.format = VIDEO_FORMAT_NONE;
-        plugin->obs_video_frame.range  = VIDEO_RANGE_DEFAULT;
-        if (init) {
-            comms_task(CommsTask::TALLY);
-            droidcam_signal(plugin->source, "droidcam_connect");
+    if (plugin->video_format == FORMAT_MJPG) {
+        if (plugin->scale_to_display) {
+            const uint64_t now = os_gettime_ns();
+            if (now - plugin->display_check_ts > 2 * NANO_SEC) {
+                plugin->display_check_ts = now;
+                update_display_size(plugin);
+            }
+            ((MJpegDecoder*)decoder)->set_display_size(plugin->display_width, plugin->display_height);
         } else {
-            elog("could not initialize decoder");
-            decoder->failed = true;
-            goto FAILED;
+            ((MJpegDecoder*)decoder)->set_display_size(0, 0);
         }
     }
 
+    decoder->drop_policy = plugin->drop_policy;
+    decoder->latency_budget_ns = (uint64_t) plugin->latency_budget_ms * 1000000;
+    decoder->recovery_limit = plugin->recovery_limit;
+    decoder->recovery_window_ns = (uint64_t) plugin->recovery_window_s * NANO_SEC;
     decoder->push_ready_packet(data_packet);
+    os_event_signal(plugin->decode_signal);
+    return true;
+}
+
+// Video thread: a decoder for the stream about to start. Only the object is
+// created here, the decode thread opens the codec, see init_video_decoder().
+static void create_video_decoder(droidcam_obs_source *plugin) {
+    if (plugin->video_decoder)
+        return;
+
+    Decoder *decoder;
+    if (plugin->video_format == FORMAT_MJPG) {
+        decoder = new MJpegDecoder();
+    }
+    else {
+        decoder = new FFMpegDecoder(plugin->video_format == FORMAT_HEVC ? AV_CODEC_ID_H265 : AV_CODEC_ID_H264);
+    }
+
+    decoder->threading = plugin->decode_threading;
+    decoder->width_hint = plugin->video_width;
+    decoder->height_hint = plugin->video_height;
+    plugin->decoder_format = plugin->video_format;
+    plugin->decoder_width  = plugin->video_width;
+    plugin->decoder_height = plugin->video_height;
+    plugin->video_decoder = decoder;
+}
+
+// A receive socket handed to the reactor: its frames are read and parsed on
+// the reactor pool. The source thread still connects, sends the request and
+// supervises the connection (see reactor.h).
+struct ReceiveStream {
+    droidcam_obs_source *plugin;
+    FrameReader *reader;
+    ReactorStream stream;
+};
+
+static bool video_readable(void *data) {
+    ReceiveStream *rx = (ReceiveStream*) data;
+    // frames buffered before a close are still delivered
+    const bool open = rx->reader->drain();
+    while (recv_video_frame(rx->plugin, rx->reader));
+    return open && rx->reader->waiting;
+}
+
+// Switch a connected socket to the reactor. Returns false to keep
+// receiving on the calling thread (reactor disabled or unavailable).
+static bool receive_start(ReceiveStream *rx, socket_t sock) {
+    if (!reactor_available())
+        return false;
+
+    set_nonblock(sock, 1);
+    rx->reader->reset(sock, true);
+    rx->stream.sock = sock;
+    if (reactor_add(&rx->stream))
+        return true;
+
+    elog("could not add socket %d to the reactor, receiving on the source thread", sock);
+    set_nonblock(sock, 0);
+    rx->reader->reset(sock);
+    return false;
+}
+
+// Wait a while on a reactor serviced socket.
+// Returns false once the connection failed, stalled or must be reset.
+static bool receive_watch(ReceiveStream *rx, os_event_t *wake, os_event_t *reset) {
+    os_event_timedwait(wake, MILLI_SEC);
+    if (rx->stream.failed)
+        return false;
+
+    if (reset && os_event_try(reset) != EAGAIN)
+        return false;
+
+    if (os_gettime_ns() - rx->stream.last_ts > (uint64_t) RECV_TIMEOUT_SEC * NANO_SEC) {
+        elog("recv timeout");
+        return false;
+    }
+
     return true;
 }
 
@@ -365,9 +756,18 @@ static void *video_thread(void *data) {
     droidcam_obs_source *plugin = (droidcam_obs_source*)(data);
     const char *obs_version_str = obs_get_version_string();
     socket_t sock = INVALID_SOCKET;
+    FrameReader reader(VIDEO_READER_SIZE);
     char remote_url[256];
     char video_req[256];
     int video_req_len = 0;
+    int usb_port = 0;
+    Backoff backoff(RETRY_MIN_MS, RETRY_MAX_MS);
+    ReceiveStream rx;
+    rx.plugin = plugin;
+    rx.reader = &reader;
+    rx.stream.wake = plugin->video_wake;
+    rx.stream.on_readable = video_readable;
+    rx.stream.data = &rx;
 
     #if DROIDCAM_OVERRIDE
     // todo: dont do this
@@ -381,36 +781,20 @@ static void *video_thread(void *data) {
 
     ilog("video_thread start");
 
-    // Preload devices if plugin is created already active
-    // (ex. when obs is re-launched)
-    // This saves an unnecessary initial SLOW_LOOP
-    if (plugin->activated) {
-        switch (plugin->device_info.type) {
-            case DeviceType::MDNS:
-                plugin->mdnsMgr.Reload();
-                plugin->mdnsMgr.ResetIter();
-                break;
-            case DeviceType::ADB:
-                plugin->adbMgr.Reload();
-                plugin->adbMgr.ResetIter();
-                break;
-            case DeviceType::IOS:
-                plugin->iosMgr.Reload();
-                plugin->iosMgr.ResetIter();
-                break;
-            case DeviceType::WIFI:
-            case DeviceType::NONE:
-                break;
-        }
-    }
-
     while (SOURCE_EXISTS()) {
-        if (plugin->activated && plugin->is_showing) {
+        if (plugin->activated && plugin->is_showing && !plugin->audio_only) {
             if (plugin->video_running) {
-                if (os_event_try(plugin->reset_signal) == EAGAIN
-                    && recv_video_frame(plugin, sock))
+                if (rx.stream.id) {
+                    if (receive_watch(&rx, plugin->video_wake, plugin->reset_signal))
+                        continue;
+
+                    reactor_remove(&rx.stream);
+                }
+                else if (os_event_try(plugin->reset_signal) == EAGAIN
+                    && recv_video_frame(plugin, &reader))
                     continue;
 
+                reader.log_stats("video");
                 plugin->video_running = false;
                 dlog("closing failed video socket %d", sock);
                 net_close(sock);
@@ -418,13 +802,13 @@ static void *video_thread(void *data) {
                 goto SLOW_LOOP;
             }
 
-            if ((sock = connect(plugin)) == INVALID_SOCKET)
+            if ((sock = connect(plugin, &usb_port)) == INVALID_SOCKET)
                 goto SLOW_LOOP;
 
             video_req_len = snprintf(video_req, sizeof(video_req), VIDEO_REQ,
                 VideoFormatNames[plugin->video_format][1],
                 plugin->video_width, plugin->video_height,
-                plugin->usb_port,
+                usb_port,
                 os_name_version,
                 #if DROIDCAM_OVERRIDE
                 ""/*obs_version_str*/, client_version_str, 0/*use_hdr*/,
@@ -441,17 +825,27 @@ static void *video_thread(void *data) {
                 sock = INVALID_SOCKET;
 
                 SLOW_LOOP:
-                os_sleep_ms(MILLI_SEC * 2);
+                os_event_timedwait(plugin->video_wake, backoff.next());
                 goto LOOP;
             }
 
             set_recv_buf_len(sock, 65536 * 4);
+            reader.reset(sock);
+            backoff.reset();
+            reconnect_cancel(&plugin->reconnect);
+            plugin->connect_warm = plugin->video_decoder != NULL;
+            create_video_decoder(plugin);
+            plugin->connect_ts = os_gettime_ns();
+            plugin->audio_connect_ts = plugin->enable_audio ? plugin->connect_ts.load() : 0;
+            plugin->av_clock.log_stats();
+            plugin->av_clock.reset();
             plugin->video_running = true;
+            os_event_signal(plugin->audio_wake);
             dlog("starting video via socket %d", sock);
 
             int port = (plugin->device_info.type == DeviceType::ADB
                     || plugin->device_info.type == DeviceType::IOS)
-                ? plugin->usb_port
+                ? usb_port
                 : plugin->device_info.port;
 
             if (port > 0) {
@@ -462,10 +856,13 @@ static void *video_thread(void *data) {
             }
 
             os_event_reset(plugin->reset_signal);
+            if (receive_start(&rx, sock))
+                dlog("video socket %d on the reactor", sock);
             continue;
         }
         // else: not activated
         video_req_len = 0;
+        reconnect_cancel(&plugin->reconnect);
 
         LOOP:
         if (plugin->video_running) {
@@ -473,41 +870,64 @@ static void *video_thread(void *data) {
         }
 
         if (sock != INVALID_SOCKET) {
+            reactor_remove(&rx.stream);
+            reader.log_stats("video");
             dlog("closing active video socket %d", sock);
             net_close(sock);
             sock = INVALID_SOCKET;
         }
 
         if (plugin->video_decoder) {
-            if (plugin->video_decoder->ready)
+            Decoder *decoder = plugin->video_decoder;
+            if (decoder->ready && !plugin->decoder_warm)
                 droidcam_signal(plugin->source, "droidcam_disconnect");
 
-            while (plugin->video_decoder->recieveQueue.items.size() < plugin->video_decoder->alloc_count
-                    && SOURCE_EXISTS())
+            // Just a reconnect: keep the codec, its hw context and packet pool.
+            // The decode thread flushes and drops anything still queued.
+            if (plugin->activated && plugin->is_showing && !plugin->audio_only
+                && decoder->ready && !decoder->failed
+                && plugin->decoder_format == plugin->video_format
+                && plugin->decoder_width  == plugin->video_width
+                && plugin->decoder_height == plugin->video_height)
             {
-                dlog("waiting for decode thread: %lu/%lu",
-                    plugin->video_decoder->recieveQueue.items.size(),
-                    plugin->video_decoder->alloc_count);
-                os_sleep_ms(MILLI_SEC / FPS);
+                if (!plugin->decoder_warm) {
+                    dlog("keep video_decoder for reconnect");
+                    decoder->generation ++;
+                    plugin->decoder_warm = true;
+                }
+                goto RELEASED;
             }
 
-            dlog("release video_decoder");
-            delete plugin->video_decoder;
+            // The decode thread may still be inside it (or a packet it holds),
+            // so it gets deleted there, once that thread lets go.
+            plugin->decoder_warm = false;
             plugin->video_decoder = NULL;
+            {
+                std::lock_guard<std::mutex> guard(plugin->retired_lock);
+                plugin->retired_decoders.push_back(decoder);
+            }
+            os_event_signal(plugin->decode_signal);
         }
 
+        RELEASED:
         obs_source_output_video2(plugin->source, NULL);
-        os_sleep_ms(MILLI_SEC / FPS);
+        if (!(plugin->activated && plugin->is_showing && !plugin->audio_only))
+            os_event_timedwait(plugin->video_wake, IDLE_WAIT);
     }
 
+    plugin->video_bytes = reader.total_bytes + reader.recv_bytes;
+    plugin->av_clock.log_stats();
     ilog("video_thread end");
     plugin->video_running = false;
+    reactor_remove(&rx.stream);
+    plugin->thread_cpu_ns[THREAD_VIDEO] = get_thread_cpu_ns();
+    plugin->thread_cpu_ns[THREAD_VIDEO_RX] = rx.stream.cpu_ns;
     if (sock != INVALID_SOCKET) net_close(sock);
     return NULL;
 }
 
 static bool
-do_audio_frame(droidcam_obs_source *plugin, socket_t sock) {
+do_audio_frame(droidcam_obs_source *plugin, FrameReader *reader) {
     FFMpegDecoder *decoder = (FFMpegDecoder*)plugin->audio_decoder;
     if (!decoder) {
         dlog("create audio decoder");
@@ -517,26 +937,35 @@ do_audio_frame(droidcam_obs_source *plugin, socket_t sock) {
 
     int has_config = 0;
     bool got_output;
-    DataPacket* data_packet = read_frame(decoder, sock, &has_config);
+    const uint32_t backlog_budget_ms = (plugin->drop_policy == DROP_NEVER) ? 0 : plugin->latency_budget_ms;
+    DataPacket* data_packet = read_frame(decoder, reader, &has_config, backlog_budget_ms, false);
     if (!data_packet)
         return false;
 
+    if (plugin->sync_av)
+        plugin->av_clock.observe(AV_STREAM_AUDIO, data_packet->pts, os_gettime_ns());
+
     // NOTE: data_packet must be properly disposed from here
 
-    // Decoder failures should not happen generally.
-    // Rather than causing a connection reset, just idle
+    // See recv_video_frame()
     if (decoder->failed) {
+        if (decoder->ready) {
+            decoder->recycle_packet(data_packet);
+            return false;
+        }
+
         FAILED:
         dlog("discarding audio frame.. decoder failed");
-        decoder->push_empty_packet(data_packet);
+        decoder->recycle_packet(data_packet);
         return true;
     }
 
     if (has_config || !decoder->ready) {
         if (decoder->ready) {
             ilog("unexpected audio config change while decoder is init'd");
-            decoder->failed = true;
-            goto FAILED;
+            decoder->escalate("audio config change");
+            decoder->recycle_packet(data_packet);
+            return false;
         }
 
         if (decoder->init(data_packet->data, AV_CODEC_ID_AAC, false) < 0) {
@@ -546,20 +975,36 @@ do_audio_frame(droidcam_obs_source *plugin, socket_t sock) {
         }
 
         plugin->obs_audio_frame.format = AUDIO_FORMAT_UNKNOWN;
-        decoder->push_empty_packet(data_packet);
+        decoder->recycle_packet(data_packet);
         return true;
     }
 
 
     // decoder->push_ready_packet(data_packet);
+    decoder->recovery_limit = plugin->recovery_limit;
+    decoder->recovery_window_ns = (uint64_t) plugin->recovery_window_s * NANO_SEC;
     if (!decoder->decode_audio(&plugin->obs_audio_frame, data_packet, &got_output)) {
         elog("error decoding audio");
-        decoder->failed = true;
-        goto FAILED;
+        decoder->recycle_packet(data_packet);
+        return decoder->recover(os_gettime_ns());
     }
 
     if (got_output) {
-        plugin->obs_audio_frame.timestamp = os_gettime_ns(); // data_packet->pts * 1000;
+        const uint64_t now = os_gettime_ns();
+        uint64_t ref = plugin->sync_av ? plugin->av_clock.map(AV_STREAM_AUDIO, data_packet->pts) : 0;
+        const bool synced = ref != 0;
+        if (!synced)
+            ref = now;
+
+        if (plugin->use_audio_jitter) {
+            // mapped pts are already jitter-free, arrival times are not
+            plugin->audio_jitter.process(&plugin->obs_audio_frame, ref, data_packet->pts, now, !synced);
+        } else {
+            plugin->obs_audio_frame.timestamp = ref;
+        }
+
+        if (synced)
+            plugin->av_clock.output(AV_STREAM_AUDIO, plugin->obs_audio_frame.timestamp, now);
         #if 0
         dlog("output audio: %d frames: %d HZ, Fmt %d, Chan %d,  pts %lu",
             plugin->obs_audio_frame.frames,
@@ -569,25 +1014,55 @@ do_audio_frame(droidcam_obs_source *plugin, socket_t sock) {
             plugin->obs_audio_frame.timestamp);
         #endif
         obs_source_output_audio(plugin->source, &plugin->obs_audio_frame);
+
+        uint64_t connect_ts = plugin->audio_connect_ts.exchange(0);
+        if (connect_ts)
+            ilog("audio: first sample %.1fms after connect",
+                (double) (now - connect_ts) / 1000000.0);
     }
 
-    decoder->push_empty_packet(data_packet);
+    decoder->recycle_packet(data_packet);
     return true;
 }
 
+
+static bool audio_readable(void *data) {
+    ReceiveStream *rx = (ReceiveStream*) data;
+    // frames buffered before a close are still delivered
+    const bool open = rx->reader->drain();
+    while (do_audio_frame(rx->plugin, rx->reader));
+    return open && rx->reader->waiting;
+}
+
 static void *audio_thread(void *data) {
     droidcam_obs_source *plugin = (droidcam_obs_source*)(data);
     socket_t sock = INVALID_SOCKET;
+    FrameReader reader(AUDIO_READER_SIZE);
     const char *audio_req = AUDIO_REQ;
+    Backoff backoff(RETRY_MIN_MS, RETRY_MAX_MS);
+    ReceiveStream rx;
+    rx.plugin = plugin;
+    rx.reader = &reader;
+    rx.stream.wake = plugin->audio_wake;
+    rx.stream.on_readable = audio_readable;
+    rx.stream.data = &rx;
 
     ilog("audio_thread start");
     while (SOURCE_EXISTS()) {
         if (plugin->activated && plugin->is_showing && plugin->enable_audio) {
             if (plugin->audio_running) {
-                if (do_audio_frame(plugin, sock)) {
+                if (rx.stream.id) {
+                    if (receive_watch(&rx, plugin->audio_wake, NULL))
+                        continue;
+
+                    reactor_remove(&rx.stream);
+                }
+                else if (do_audio_frame(plugin, &reader)) {
                     continue;
                 }
 
+                reader.log_stats("audio");
+                plugin->audio_jitter.log_stats();
                 plugin->audio_running = false;
                 dlog("closing failed audio socket %d", sock);
                 net_close(sock);
@@ -595,13 +1070,11 @@ static void *audio_thread(void *data) {
                 goto SLOW_LOOP;
             }
 
-            // connect audio only after video works
-            if (!plugin->video_running)
+            // Connect as soon as the video socket is up (ADB/iOS need its port
+            // mapping), while the app is still starting the video stream.
+            if (!plugin->video_running && !plugin->audio_only)
                 goto LOOP;
 
-            // no rush..
-            os_sleep_ms(MILLI_SEC);
-
             if ((sock = connect(plugin)) == INVALID_SOCKET)
                 goto SLOW_LOOP;
 
@@ -611,12 +1084,29 @@ static void *audio_thread(void *data) {
                 sock = INVALID_SOCKET;
 
                 SLOW_LOOP:
-                os_sleep_ms(MILLI_SEC * 2);
+                os_event_timedwait(plugin->audio_wake, backoff.next());
                 goto LOOP;
             }
 
+            backoff.reset();
+            if (!plugin->audio_decoder)
+                plugin->audio_decoder = new FFMpegDecoder();
+
+            if (plugin->audio_connect_ts == 0)
+                plugin->audio_connect_ts = os_gettime_ns();
+
+            reader.reset(sock);
+            plugin->audio_jitter.reset();
             plugin->audio_running = true;
             dlog("starting audio via socket %d", sock);
+            if (plugin->audio_only) {
+                reconnect_cancel(&plugin->reconnect);
+                // nothing else brings up the comms channel in this mode
+                comms_task(CommsTask::TALLY);
+                droidcam_signal(plugin->source, "droidcam_connect");
+            }
+            if (receive_start(&rx, sock))
+                dlog("audio socket %d on the reactor", sock);
             continue;
         }
 
@@ -627,6 +1117,9 @@ static void *audio_thread(void *data) {
 
         LOOP:
         if (sock != INVALID_SOCKET) {
+            reactor_remove(&rx.stream);
+            reader.log_stats("audio");
+            plugin->audio_jitter.log_stats();
             dlog("closing active audio socket %d", sock);
             net_close(sock);
             sock = INVALID_SOCKET;
@@ -639,59 +1132,52 @@ static void *audio_thread(void *data) {
         }
 
         if (plugin->enable_audio) obs_source_output_audio(plugin->source, NULL);
-        os_sleep_ms(MILLI_SEC / FPS);
+        if (!(plugin->activated && plugin->is_showing && plugin->enable_audio
+            && (plugin->video_running || plugin->audio_only)))
+            os_event_timedwait(plugin->audio_wake, IDLE_WAIT);
     }
 
+    plugin->audio_bytes = reader.total_bytes + reader.recv_bytes;
     ilog("audio_thread end");
     plugin->audio_running = false;
+    reactor_remove(&rx.stream);
+    plugin->thread_cpu_ns[THREAD_AUDIO] = get_thread_cpu_ns();
+    plugin->thread_cpu_ns[THREAD_AUDIO_RX] = rx.stream.cpu_ns;
     if (sock != INVALID_SOCKET) net_close(sock);
     return NULL;
 }
 
-static int
-basic_http(socket_t sock, char* buf, const size_t maxlen, const char *request, const size_t len) {
-    if (net_send_all(sock, request, len) <= 0) {
-        return 0;
-    }
-
-    memset(buf, 0, maxlen);
-    int i = 0;
-    while (i < maxlen) {
-        int rc = net_recv(sock, &buf[i], maxlen - i);
-        if (rc > 0) {
-            i += rc;
-            continue;
-        }
-
-        #if _WIN32
-        WSAErrno();
-        if (rc < 0 && (errno == WSAEWOULDBLOCK || errno == WSAETIMEDOUT))
-            break;
-
-        #else
-        if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS))
-            break;
-
-        #endif
-
-        return 0;
-    }
+// One request on the comms connection. A kept-alive connection that the app
+// closed while idle is reopened and the request retried once.
+static bool
+comms_request(struct droidcam_obs_source *plugin, HttpClient *http,
+    const char *request, const size_t len, HttpResponse *res)
+{
+    if (http->request(request, len, res))
+        return true;
 
-    for (i = 0; i < maxlen; i++) {
-        if (!(buf[i] == '\r' && buf[i+1] == '\n' && buf[i+2] == '\r' && buf[i+3] == '\n'))
-            continue;
+    if (!http->stale)
+        return false;
 
-        return i+4;
-    }
+    dlog("comms: socket %d was closed while idle, reconnecting", http->sock);
+    net_close(http->sock);
+    http->reset(connect(plugin));
+    if (http->sock == INVALID_SOCKET)
+        return false;
 
-    return 0;
+    set_recv_timeout(http->sock, 1);
+    return http->request(request, len, res);
 }
 
 static void *comms_thread(void *data) {
     droidcam_obs_source *plugin = (droidcam_obs_source*)(data);
-    socket_t sock = INVALID_SOCKET;
-    char buf[4096] = {0};
-    const size_t maxlen = sizeof(buf) - 4;
+    HttpClient http;
+    HttpResponse res;
+    char req[256];
+
+    uint64_t tally_count = 0;
+    uint64_t tally_rtt_sum = 0;
+    uint64_t tally_rtt_max = 0;
 
     #if DROIDCAM_OVERRIDE
     const char *battery_req = BATT_REQ;
@@ -708,49 +1194,52 @@ static void *comms_thread(void *data) {
     {
         os_event_reset(plugin->comms_signal);
 
-        if (plugin->activated && plugin->video_running) {
-
-            if (sock == INVALID_SOCKET) {
-                if ((sock = connect(plugin)) == INVALID_SOCKET)
+        if (plugin->activated
+            && (plugin->video_running || (plugin->audio_only && plugin->audio_running)))
+        {
+            if (http.sock == INVALID_SOCKET) {
+                socket_t sock = connect(plugin);
+                if (sock == INVALID_SOCKET)
                     continue;
+
                 set_recv_timeout(sock, 1);
+                http.reset(sock);
             }
         }
         else {
-            if (sock != INVALID_SOCKET) {
+            if (http.sock != INVALID_SOCKET) {
                 #if DROIDCAM_OVERRIDE
                 prevBattery = 100;
-                buf[0] = 0;
-                signal_source_update(plugin->source, (const char*) &buf[0], 0);
+                signal_source_update(plugin->source, "", 0);
                 #endif
 
                 CLOSE:
-                dlog("closing comms socket %d // (%d) %s", sock, errno, strerror(errno));
-                net_close(sock);
-                sock = INVALID_SOCKET;
+                dlog("closing comms socket %d // (%d) %s", http.sock, errno, strerror(errno));
+                net_close(http.sock);
+                http.reset(INVALID_SOCKET);
             }
         }
 
-        if (sock == INVALID_SOCKET)
+        if (http.sock == INVALID_SOCKET)
             continue;
 
         if (event == ETIMEDOUT) {
             #if DROIDCAM_OVERRIDE
-            int i = basic_http(sock, buf, maxlen, battery_req, sizeof(BATT_REQ) - 1);
-            if (i > 0) {
-                int start = i;
-                for (; i < maxlen && isdigit(buf[i]); i++);
-
-                if (i > start) {
-                    buf[i++] = '%';
-                    buf[i  ] = 0;
-
-                    const char* value = (const char*) &buf[start];
-                    i = atoi(value);
-                    const int alert = (prevBattery > WARN && i <= WARN);
-                    dlog("battery %d -> %d (%s) alert=%d", prevBattery, i, value, alert);
+            if (comms_request(plugin, &http, battery_req, sizeof(BATT_REQ) - 1, &res)) {
+                char value[8];
+                size_t i = 0;
+                for (; i < res.body_len && i < sizeof(value) - 2 && isdigit(res.body[i]); i++)
+                    value[i] = res.body[i];
+
+                if (i > 0) {
+                    value[i++] = '%';
+                    value[i  ] = 0;
+
+                    const int level = atoi(value);
+                    const int alert = (prevBattery > WARN && level <= WARN);
+                    dlog("battery %d -> %d (%s) alert=%d", prevBattery, level, value, alert);
                     signal_source_update(plugin->source, value, alert);
-                    prevBattery = i;
+                    prevBattery = level;
                 }
             }
             else goto CLOSE;
@@ -778,9 +1267,12 @@ static void *comms_thread(void *data) {
         }
 
         if (tally != NULL) {
-            int len = snprintf(buf, maxlen, TALLY_REQ, tally);
-            if (basic_http(sock, buf, maxlen, (const char*) &buf[0], len) > 0) {
-                dlog("comms: tally -> %s", tally);
+            int len = snprintf(req, sizeof(req), TALLY_REQ, tally);
+            if (comms_request(plugin, &http, req, len, &res)) {
+                tally_count ++;
+                tally_rtt_sum += http.rtt_ns;
+                if (http.rtt_ns > tally_rtt_max) tally_rtt_max = http.rtt_ns;
+                ilog("comms: tally -> %s (%d) in %.1fms", tally, res.status, (double) http.rtt_ns / 1000000.0);
             }
             else {
                 if (errno != 0) {
@@ -793,14 +1285,88 @@ static void *comms_thread(void *data) {
                 goto CLOSE;
             }
         }
+
+        // The app asked to close after its response
+        if (!http.keep_alive)
+            goto CLOSE;
     } // while (SOURCE_EXISTS)
 
-    if (sock != INVALID_SOCKET) net_close(sock);
+    if (http.sock != INVALID_SOCKET) net_close(http.sock);
+
+    if (http.requests > 0)
+        ilog("comms: %llu requests over %llu connections, tally rtt avg %.1fms max %.1fms (%llu)",
+            (unsigned long long) http.requests,
+            (unsigned long long) http.connections,
+            tally_count ? (double) tally_rtt_sum / tally_count / 1000000.0 : 0.0,
+            (double) tally_rtt_max / 1000000.0,
+            (unsigned long long) tally_count);
 
+    plugin->thread_cpu_ns[THREAD_COMMS] = get_thread_cpu_ns();
     dlog("comms_thread end");
     return NULL;
 }
 
+// Video and decode threads are only started once the source is not audio-only
+static bool start_video_threads(droidcam_obs_source *plugin) {
+    if (!plugin->video_thread_started) {
+        if (pthread_create(&plugin->video_thread, NULL, video_thread, plugin) != 0)
+            return false;
+
+        plugin->video_thread_started = true;
+    }
+
+    if (!plugin->decode_thread_started) {
+        if (pthread_create(&plugin->video_decode_thread, NULL, video_decode_thread, plugin) != 0)
+            return false;
+
+        plugin->decode_thread_started = true;
+    }
+
+    return true;
+}
+
+// Charge the time since the last mode change to the current mode
+static void account_mode_time(droidcam_obs_source *plugin) {
+    const uint64_t now = os_gettime_ns();
+    if (plugin->mode_ts)
+        plugin->mode_ns[plugin->audio_only] += now - plugin->mode_ts;
+
+    plugin->mode_ts = now;
+}
+
+// Per-source resource use, to compare audio-only with audio+video
+static void log_session_stats(droidcam_obs_source *plugin) {
+    const double seconds = (double) (os_gettime_ns() - plugin->time_start * 100) / NANO_SEC;
+    if (seconds <= 0)
+        return;
+
+    // audio_only can be toggled mid-session, only label it with one mode if it wasn't
+    char mode[64];
+    account_mode_time(plugin);
+    if (plugin->mode_ns[0] && plugin->mode_ns[1])
+        snprintf(mode, sizeof(mode), "audio+video %.0fs, audio only %.0fs",
+            (double) plugin->mode_ns[0] / NANO_SEC, (double) plugin->mode_ns[1] / NANO_SEC);
+    else
+        snprintf(mode, sizeof(mode), "%s", plugin->mode_ns[1] ? "audio only" : "audio+video");
+
+    uint64_t total_ns = 0;
+    char cpu[192];
+    int len = 0;
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        total_ns += plugin->thread_cpu_ns[i];
+        len += snprintf(&cpu[len], sizeof(cpu) - len, " %s=%.1fs",
+            SourceThreadNames[i], (double) plugin->thread_cpu_ns[i] / NANO_SEC);
+    }
+
+    ilog("session (%s, %.0fs): cpu%s (%.2f%% of one core); received video %llu KB (%.0f kbps), audio %llu KB (%.0f kbps)",
+        mode, seconds, cpu,
+        (double) total_ns / NANO_SEC / seconds * 100.0,
+        (unsigned long long) plugin->video_bytes / 1024,
+        (double) plugin->video_bytes * 8 / 1000.0 / seconds,
+        (unsigned long long) plugin->audio_bytes / 1024,
+        (double) plugin->audio_bytes * 8 / 1000.0 / seconds);
+}
+
 void source_destroy(void *data) {
     droidcam_obs_source *plugin = (droidcam_obs_source*)(data);
     ilog("destroy: \"%s\"", obs_source_get_name(plugin->source));
@@ -809,20 +1375,33 @@ void source_destroy(void *data) {
         if (plugin->time_start != 0) {
             ilog("stopping");
             os_event_signal(plugin->stop_signal);
-            pthread_join(plugin->video_thread, NULL);
+            wake_threads(plugin);
+            if (plugin->video_thread_started)
+                pthread_join(plugin->video_thread, NULL);
             pthread_join(plugin->audio_thread, NULL);
 
             os_event_signal(plugin->comms_signal);
+            os_event_signal(plugin->decode_signal);
             pthread_join(plugin->comms_thread, NULL);
-            pthread_join(plugin->video_decode_thread, NULL);
+            if (plugin->decode_thread_started)
+                pthread_join(plugin->video_decode_thread, NULL);
+
+            reconnect_cancel(&plugin->reconnect);
+
+            log_session_stats(plugin);
 
             os_event_destroy(plugin->stop_signal);
             os_event_destroy(plugin->reset_signal);
             os_event_destroy(plugin->comms_signal);
+            os_event_destroy(plugin->video_wake);
+            os_event_destroy(plugin->audio_wake);
+            os_event_destroy(plugin->decode_signal);
         }
 
         ilog("cleanup");
         if (plugin->video_decoder) delete plugin->video_decoder;
+        for (Decoder *decoder : plugin->retired_decoders)
+            delete decoder; // the decode thread never started
         if (plugin->audio_decoder) delete plugin->audio_decoder;
         delete plugin;
     }
@@ -848,6 +1427,18 @@ static void settings_migration(obs_data_t *settings, droidcam_obs_source *plugin
     }
 }
 
+// Settings are user-editable JSON, and enums index name tables:
+// anything outside the property's range falls back to the default.
+static int get_setting(obs_data_t *settings, const char *name, int min, int max) {
+    const long long value = obs_data_get_int(settings, name);
+    if (value >= min && value <= max)
+        return (int) value;
+
+    const int def = (int) obs_data_get_default_int(settings, name);
+    elog("%s=%lld out of range [%d, %d], using %d", name, value, min, max, def);
+    return def;
+}
+
 void *source_create(obs_data_t *settings, obs_source_t *source) {
     ilog("Source: \"%s\" - " PLUGIN_VERSION_STR, obs_source_get_name(source));
     droidcam_obs_source *plugin = new droidcam_obs_source();
@@ -862,9 +1453,19 @@ void *source_create(obs_data_t *settings, obs_source_t *source) {
     plugin->use_hw = obs_data_get_bool(settings, OPT_USE_HW_ACCEL);
     plugin->use_hdr = obs_data_get_bool(settings, OPT_USE_HDR);
     plugin->video_format = (VideoFormat) obs_data_get_int(settings, OPT_VIDEO_FORMAT);
-    plugin->enable_audio  = obs_data_get_bool(settings, OPT_ENABLE_AUDIO);
+    plugin->audio_only = obs_data_get_bool(settings, OPT_AUDIO_ONLY);
+    plugin->enable_audio  = obs_data_get_bool(settings, OPT_ENABLE_AUDIO) || plugin->audio_only;
     plugin->deactivateWNS = obs_data_get_bool(settings, OPT_DEACTIVATE_WNS);
     plugin->activated = obs_data_get_bool(settings, OPT_IS_ACTIVATED);
+    plugin->drop_policy = (DropPolicy) get_setting(settings, OPT_DROP_POLICY, DROP_TO_KEYFRAME, DROP_NEVER);
+    plugin->latency_budget_ms = get_setting(settings, OPT_LATENCY_BUDGET, 50, 5000);
+    plugin->decode_threading = (DecodeThreading) get_setting(settings, OPT_DECODE_THREADING, THREADING_AUTO, THREADING_FRAME);
+    plugin->recovery_limit = get_setting(settings, OPT_RECOVERY_LIMIT, 0, 50);
+    plugin->recovery_window_s = get_setting(settings, OPT_RECOVERY_WINDOW, 5, 600);
+    plugin->scale_to_display = obs_data_get_bool(settings, OPT_SCALE_TO_DISPLAY);
+    plugin->sync_av = obs_data_get_bool(settings, OPT_SYNC_AV);
+    plugin->use_audio_jitter = obs_data_get_bool(settings, OPT_AUDIO_JITTER);
+    obs_source_set_async_decoupled(source, !plugin->sync_av);
     obs_source_set_async_unbuffered(source, obs_data_get_bool(settings, OPT_UNBUFFERED_OUT));
     obs_data_set_string(settings, "remote_url", "");
 
@@ -953,12 +1554,25 @@ void *source_create(obs_data_t *settings, obs_source_t *source) {
         return NULL;
     }
 
-    if (pthread_create(&plugin->video_thread, NULL, video_thread, plugin) != 0) {
+    if (os_event_init(&plugin->video_wake, OS_EVENT_TYPE_AUTO) != 0) {
+        source_destroy(plugin);
+        return NULL;
+    }
+
+    if (os_event_init(&plugin->audio_wake, OS_EVENT_TYPE_AUTO) != 0) {
         source_destroy(plugin);
         return NULL;
     }
 
-    if (pthread_create(&plugin->video_decode_thread, NULL, video_decode_thread, plugin) != 0) {
+    if (os_event_init(&plugin->decode_signal, OS_EVENT_TYPE_AUTO) != 0) {
+        source_destroy(plugin);
+        return NULL;
+    }
+
+    plugin->reconnect.wake[0] = plugin->video_wake;
+    plugin->reconnect.wake[1] = plugin->audio_wake;
+
+    if (!plugin->audio_only && !start_video_threads(plugin)) {
         source_destroy(plugin);
         return NULL;
     }
@@ -974,6 +1588,7 @@ void *source_create(obs_data_t *settings, obs_source_t *source) {
     }
 
     plugin->time_start = os_gettime_ns() / 100;
+    plugin->mode_ts = os_gettime_ns();
     return plugin;
 }
 
@@ -1008,8 +1623,10 @@ void source_show(void *data) {
     }
     #endif
 
+    plugin->display_check_ts = 0; // re-check display size with the next frame
     plugin->tally.on_preview = true;
     comms_task(CommsTask::TALLY);
+    wake_threads(plugin);
     dlog("source_show: is_showing=%d", plugin->is_showing);
 }
 
@@ -1020,6 +1637,7 @@ void source_hide(void *data) {
 
     plugin->tally.on_preview = false;
     comms_task(CommsTask::TALLY);
+    wake_threads(plugin);
     dlog("source_hide: is_showing=%d", plugin->is_showing);
 }
 
@@ -1041,6 +1659,7 @@ static inline void toggle_ppts(obs_properties_t *ppts, bool enable) {
     obs_property_set_enabled(obs_properties_get(ppts, OPT_WIFI_IP)     , enable);
     obs_property_set_enabled(obs_properties_get(ppts, OPT_APP_PORT)    , enable);
     obs_property_set_enabled(obs_properties_get(ppts, OPT_ENABLE_AUDIO), enable);
+    obs_property_set_enabled(obs_properties_get(ppts, OPT_AUDIO_ONLY)  , enable);
     obs_property_set_enabled(obs_properties_get(ppts, OPT_USE_HW_ACCEL), enable);
     obs_property_set_enabled(obs_properties_get(ppts, OPT_USE_HDR)     , enable);
 }
@@ -1112,6 +1731,7 @@ static bool video_parms_changed(void *data, obs_properties_t*, obs_property_t*,
     plugin->video_height = height;
     plugin->video_format = video_format;
     os_event_signal(plugin->reset_signal);
+    wake_threads(plugin);
     return false;
 }
 
@@ -1237,6 +1857,7 @@ static bool connect_clicked(obs_properties_t *ppts, obs_property_t *p, void *dat
     ilog("video_format=%s video_resolution=%dx%d", VideoFormatNames[plugin->video_format][1], plugin->video_width, plugin->video_height);
 
     out:
+    wake_threads(plugin);
     obs_property_set_enabled(cp, true);
     if (settings) obs_data_release(settings);
     return true;
@@ -1299,10 +1920,22 @@ static bool refresh_clicked(obs_properties_t *ppts, obs_property_t *p, void *dat
 void source_update(void *data, obs_data_t *settings) {
     droidcam_obs_source *plugin = (droidcam_obs_source*)(data);
     plugin->deactivateWNS = obs_data_get_bool(settings, OPT_DEACTIVATE_WNS);
-    plugin->enable_audio  = obs_data_get_bool(settings, OPT_ENABLE_AUDIO);
+    bool audio_only = obs_data_get_bool(settings, OPT_AUDIO_ONLY);
+    if (audio_only != plugin->audio_only && plugin->time_start != 0) {
+        account_mode_time(plugin);
+        ilog("switching to %s", audio_only ? "audio only" : "audio+video");
+    }
+    plugin->audio_only = audio_only;
+    plugin->enable_audio  = obs_data_get_bool(settings, OPT_ENABLE_AUDIO) || plugin->audio_only;
     plugin->use_hw = obs_data_get_bool(settings, OPT_USE_HW_ACCEL);
     plugin->use_hdr = obs_data_get_bool(settings, OPT_USE_HDR);
-    bool sync_av = false; // obs_data_get_bool(settings, OPT_SYNC_AV);
+    plugin->drop_policy = (DropPolicy) get_setting(settings, OPT_DROP_POLICY, DROP_TO_KEYFRAME, DROP_NEVER);
+    plugin->latency_budget_ms = get_setting(settings, OPT_LATENCY_BUDGET, 50, 5000);
+    plugin->decode_threading = (DecodeThreading) get_setting(settings, OPT_DECODE_THREADING, THREADING_AUTO, THREADING_FRAME);
+    plugin->recovery_limit = get_setting(settings, OPT_RECOVERY_LIMIT, 0, 50);
+    plugin->recovery_window_s = get_setting(settings, OPT_RECOVERY_WINDOW, 5, 600);
+    plugin->scale_to_display = obs_data_get_bool(settings, OPT_SCALE_TO_DISPLAY);
+    bool sync_av = obs_data_get_bool(settings, OPT_SYNC_AV);
     bool activated = obs_data_get_bool(settings, OPT_IS_ACTIVATED);
     bool unbuffered = obs_data_get_bool(settings, OPT_UNBUFFERED_OUT);
 
@@ -1314,12 +1947,19 @@ void source_update(void *data, obs_data_t *settings) {
         sync_av);
 
     obs_source_set_async_decoupled(plugin->source, !sync_av); // nb: only works when in unbuffered mode.
+    plugin->sync_av = sync_av;
+    plugin->use_audio_jitter = obs_data_get_bool(settings, OPT_AUDIO_JITTER);
     obs_source_set_async_unbuffered(plugin->source, unbuffered);
 
     // handle [Cancel] case
     if (activated != plugin->activated) {
         plugin->activated = activated;
     }
+
+    if (!plugin->audio_only && plugin->time_start != 0 && !start_video_threads(plugin))
+        elog("could not start video threads");
+
+    wake_threads(plugin);
 }
 
 obs_properties_t *source_properties(void *data) {
@@ -1399,7 +2039,9 @@ obs_properties_t *source_properties(void *data) {
     obs_properties_add_int(ppts, OPT_APP_PORT, "DroidCam Port", 1, 65535, 1);
 
     obs_properties_add_bool(ppts, OPT_ENABLE_AUDIO, TEXT_ENABLE_AUDIO);
-    // obs_properties_add_bool(ppts, OPT_SYNC_AV, TEXT_SYNC_AV);
+    obs_properties_add_bool(ppts, OPT_AUDIO_ONLY, TEXT_AUDIO_ONLY);
+    obs_properties_add_bool(ppts, OPT_SYNC_AV, TEXT_SYNC_AV);
+    obs_properties_add_bool(ppts, OPT_AUDIO_JITTER, TEXT_AUDIO_JITTER);
     #if DROIDCAM_OVERRIDE==0
     obs_properties_add_bool(ppts, OPT_DEACTIVATE_WNS, TEXT_DWNS);
     #endif
@@ -1407,7 +2049,25 @@ obs_properties_t *source_properties(void *data) {
     cp = obs_properties_add_bool(ppts, OPT_UNBUFFERED_OUT, TEXT_LATENCY_TOGGLE);
     obs_property_set_long_description(cp, TEXT_LATENCY_DESCR);
 
+    cp = obs_properties_add_list(ppts, OPT_DROP_POLICY, TEXT_DROP_POLICY, OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+    obs_property_list_add_int(cp, TEXT_DROP_TO_KEYFRAME, DROP_TO_KEYFRAME);
+    obs_property_list_add_int(cp, TEXT_DROP_OLDEST, DROP_OLDEST);
+    obs_property_list_add_int(cp, TEXT_DROP_NEVER, DROP_NEVER);
+
+    cp = obs_properties_add_int(ppts, OPT_LATENCY_BUDGET, TEXT_LATENCY_BUDGET, 50, 5000, 50);
+    obs_property_int_set_suffix(cp, " ms");
+
+    obs_properties_add_int(ppts, OPT_RECOVERY_LIMIT, TEXT_RECOVERY_LIMIT, 0, 50, 1);
+    cp = obs_properties_add_int(ppts, OPT_RECOVERY_WINDOW, TEXT_RECOVERY_WINDOW, 5, 600, 5);
+    obs_property_int_set_suffix(cp, " s");
+
     obs_properties_add_bool(ppts, OPT_USE_HW_ACCEL, TEXT_USE_HW_ACCEL);
+
+    cp = obs_properties_add_list(ppts, OPT_DECODE_THREADING, TEXT_DECODE_THREADING, OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+    obs_property_list_add_int(cp, TEXT_THREADING_AUTO, THREADING_AUTO);
+    obs_property_list_add_int(cp, TEXT_THREADING_SLICE, THREADING_SLICE);
+    obs_property_list_add_int(cp, TEXT_THREADING_FRAME, THREADING_FRAME);
+    obs_properties_add_bool(ppts, OPT_SCALE_TO_DISPLAY, TEXT_SCALE_TO_DISPLAY);
     #if DROIDCAM_OVERRIDE==0 && LIBOBS_API_MAJOR_VER > 27
     obs_properties_add_bool(ppts, OPT_USE_HDR, TEXT_USE_HDR);
     #endif
@@ -1424,11 +2084,19 @@ void source_defaults(obs_data_t *settings) {
     obs_data_set_default_bool(settings, OPT_UHD_UNLOCK, false);
     obs_data_set_default_bool(settings, OPT_IS_ACTIVATED, false);
     obs_data_set_default_bool(settings, OPT_SYNC_AV, false);
+    obs_data_set_default_bool(settings, OPT_AUDIO_JITTER, false);
     obs_data_set_default_bool(settings, OPT_USE_HDR, false);
     obs_data_set_default_bool(settings, OPT_USE_HW_ACCEL, true);
     obs_data_set_default_bool(settings, OPT_ENABLE_AUDIO, false);
+    obs_data_set_default_bool(settings, OPT_AUDIO_ONLY, false);
     obs_data_set_default_bool(settings, OPT_DEACTIVATE_WNS, false);
     obs_data_set_default_bool(settings, OPT_UNBUFFERED_OUT, true);
+    obs_data_set_default_bool(settings, OPT_SCALE_TO_DISPLAY, false);
+    obs_data_set_default_int(settings, OPT_DROP_POLICY, DROP_TO_KEYFRAME);
+    obs_data_set_default_int(settings, OPT_LATENCY_BUDGET, 500);
+    obs_data_set_default_int(settings, OPT_DECODE_THREADING, THREADING_AUTO);
+    obs_data_set_default_int(settings, OPT_RECOVERY_LIMIT, 5);
+    obs_data_set_default_int(settings, OPT_RECOVERY_WINDOW, 60);
     obs_data_set_default_int(settings, OPT_APP_PORT, DEFAULT_PORT);
     obs_data_set_default_string(settings, OPT_RESOLUTION_STR, Resolutions[0]);
 }
@@ -14,6 +14,7 @@ GNU General Public License for more details.
 You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <time.h>
 #include "plugin.h"
 
 #if __APPLE__
@@ -69,3 +70,11 @@ void get_os_name_version(char *out, size_t out_size) {
     fclose(fp);
 }
 #endif
+
+uint64_t get_thread_cpu_ns(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
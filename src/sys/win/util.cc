@@ -11,3 +11,16 @@ void get_os_name_version(char *out, size_t out_size) {
         snprintf(out, out_size, "win%d.%d.%d", win_version.major, win_version.minor, win_version.build);
     }
 }
+
+uint64_t get_thread_cpu_ns(void) {
+    FILETIME created, exited, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user))
+        return 0;
+
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return (k.QuadPart + u.QuadPart) * 100;
+}
@@ -0,0 +1,282 @@
+// Copyright (C) 2025 DEV47APPS, github.com/dev47apps
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <util/platform.h>
+#include "plugin.h"
+#include "mjpeg_decode.h"
+
+// Decodes a stream of JPEGs that changes size and chroma subsampling from
+// frame to frame (rotation, resolution switches, a new app version) and
+// checks the output frame layout, metadata and pixels after every one.
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { elog("Failed: " __VA_ARGS__); failures++; return; } \
+} while (0)
+
+struct TestImage {
+    int width, height, subsamp;
+    int display_width; // MJpegContext display size, 0 = full size
+    int out_width, out_height; // expected output size
+};
+
+static const TestImage images[] = {
+    {640, 480, TJSAMP_420, 0, 640, 480},
+    {1280, 720, TJSAMP_422, 0, 1280, 720},
+    {480, 640, TJSAMP_420, 0, 480, 640},   // rotated
+    {320, 240, TJSAMP_444, 0, 320, 240},
+    {1920, 1080, TJSAMP_420, 0, 1920, 1080},
+    {33, 17, TJSAMP_420, 0, 33, 17},       // odd sizes, partial MCUs
+    {1280, 720, TJSAMP_420, 320, 320, 180}, // scaled to cover the display
+    {640, 480, TJSAMP_422, 0, 640, 480},   // smaller again: buffer is reused
+};
+
+static enum video_format expected_format(int subsamp) {
+    switch (subsamp) {
+        case TJSAMP_420: return VIDEO_FORMAT_I420;
+        #if LIBOBS_API_MAJOR_VER >= 28
+        case TJSAMP_422: return VIDEO_FORMAT_I422;
+        #endif
+        case TJSAMP_444: return VIDEO_FORMAT_I444;
+    }
+    return VIDEO_FORMAT_NONE;
+}
+
+static bool format_supported(int subsamp) {
+    return expected_format(subsamp) != VIDEO_FORMAT_NONE;
+}
+
+static std::vector<uint8_t> make_jpeg(tjhandle tj, int width, int height, int subsamp, int seed) {
+    std::vector<uint8_t> rgb((size_t) width * height * 3);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t *p = &rgb[((size_t) y * width + x) * 3];
+            p[0] = (uint8_t) (x * 255 / width + seed);
+            p[1] = (uint8_t) (y * 255 / height);
+            p[2] = (uint8_t) ((x ^ y) + seed * 7);
+        }
+    }
+
+    unsigned char *jpeg = NULL;
+    unsigned long jpeg_size = 0;
+    if (tjCompress2(tj, rgb.data(), width, 0, height, TJPF_RGB,
+        &jpeg, &jpeg_size, subsamp, 85, TJFLAG_FASTDCT) != 0)
+    {
+        elog("tjCompress2: %s", tjGetErrorStr2(tj));
+        return std::vector<uint8_t>();
+    }
+
+    std::vector<uint8_t> out(jpeg, jpeg + jpeg_size);
+    tjFree(jpeg);
+    return out;
+}
+
+static void check_frame(const struct obs_source_frame2 *frame, const TestImage *img,
+    const std::vector<uint8_t> &jpeg, uint64_t pts)
+{
+    CHECK(frame->width == (uint32_t) img->out_width && frame->height == (uint32_t) img->out_height,
+        "size %ux%u, expected %dx%d", frame->width, frame->height, img->out_width, img->out_height);
+    CHECK(frame->format == expected_format(img->subsamp),
+        "format %d for subsamp %d", frame->format, img->subsamp);
+    CHECK(frame->range == VIDEO_RANGE_FULL, "range %d", frame->range);
+    CHECK(frame->timestamp == pts * 1000, "timestamp %llu, expected %llu",
+        (unsigned long long) frame->timestamp, (unsigned long long) (pts * 1000));
+    CHECK(frame->data[3] == NULL && frame->linesize[3] == 0, "unexpected 4th plane");
+
+    // Planes are packed back to back, each exactly as wide as turbojpeg's
+    unsigned char *ref_planes[3];
+    int ref_strides[3];
+    std::vector<uint8_t> ref[3];
+    for (int i = 0; i < 3; i++) {
+        const int plane_w = tjPlaneWidth(i, img->out_width, img->subsamp);
+        const int plane_h = tjPlaneHeight(i, img->out_height, img->subsamp);
+        CHECK(frame->linesize[i] == (uint32_t) plane_w, "plane %d linesize %u, expected %d",
+            i, frame->linesize[i], plane_w);
+
+        if (i > 0) {
+            const int prev_h = tjPlaneHeight(i - 1, img->out_height, img->subsamp);
+            CHECK(frame->data[i] == frame->data[i - 1] + (size_t) frame->linesize[i - 1] * prev_h,
+                "plane %d is not right after plane %d", i, i - 1);
+        }
+
+        ref[i].resize((size_t) plane_w * plane_h);
+        ref_planes[i] = ref[i].data();
+        ref_strides[i] = plane_w;
+    }
+
+    // Same pixels as a plain decode at that size
+    tjhandle tj = tjInitDecompress();
+    const int rc = tjDecompressToYUVPlanes(tj, jpeg.data(), jpeg.size(),
+        ref_planes, img->out_width, ref_strides, img->out_height,
+        TJFLAG_FASTDCT | TJFLAG_FASTUPSAMPLE);
+    tjDestroy(tj);
+    CHECK(rc == 0, "reference decode");
+
+    for (int i = 0; i < 3; i++) {
+        CHECK(memcmp(frame->data[i], ref[i].data(), ref[i].size()) == 0,
+            "plane %d differs from the reference decode (%dx%d subsamp %d)",
+            i, img->out_width, img->out_height, img->subsamp);
+    }
+}
+
+static void test_context(const std::vector<std::vector<uint8_t>> &jpegs) {
+    ilog("test_context()");
+    MJpegContext ctx;
+    ctx.tj = tjInitDecompress();
+    struct obs_source_frame2 frame;
+    memset(&frame, 0, sizeof(frame));
+
+    // twice through, so every size also follows a different one
+    for (int round = 0; round < 2; round++) {
+        for (size_t i = 0; i < ARRAY_LEN(images); i++) {
+            const TestImage *img = &images[i];
+            if (!format_supported(img->subsamp))
+                continue;
+
+            DataPacket packet(jpegs[i].size());
+            memcpy(packet.data, jpegs[i].data(), jpegs[i].size());
+            packet.used = jpegs[i].size();
+            packet.pts = (round * ARRAY_LEN(images) + i) * 33333;
+
+            ctx.display_width = img->display_width;
+            ctx.display_height = 0;
+            if (!ctx.decode(&frame, &packet)) {
+                elog("Failed: decode %dx%d subsamp %d", img->width, img->height, img->subsamp);
+                failures++;
+                continue;
+            }
+
+            check_frame(&frame, img, jpegs[i], packet.pts);
+
+            const size_t planes = tjPlaneSizeYUV(0, img->out_width, 0, img->out_height, img->subsamp)
+                + tjPlaneSizeYUV(1, img->out_width, 0, img->out_height, img->subsamp)
+                + tjPlaneSizeYUV(2, img->out_width, 0, img->out_height, img->subsamp);
+            if (ctx.frameBufSize < planes) {
+                elog("Failed: frame buffer %zu bytes, planes need %zu", (size_t) ctx.frameBufSize, planes);
+                failures++;
+            }
+        }
+    }
+
+    dlog("~test_context");
+}
+
+// Same stream through the decoder, inline or with frame workers:
+// frames come out in order, with their own pts
+static void test_decoder(const std::vector<std::vector<uint8_t>> &jpegs, enum DecodeThreading threading) {
+    ilog("test_decoder(%d)", threading);
+    MJpegDecoder *decoder = new MJpegDecoder();
+    decoder->threading = threading;
+    if (!decoder->init()) {
+        elog("Failed: init");
+        failures++;
+        delete decoder;
+        return;
+    }
+
+    struct obs_source_frame2 frame;
+    memset(&frame, 0, sizeof(frame));
+    std::vector<size_t> sent;
+    size_t received = 0;
+    bool got_output;
+
+    for (int round = 0; round < 4; round++) {
+        for (size_t i = 0; i < ARRAY_LEN(images); i++) {
+            // scaled output needs the display size on every worker, keep it simple
+            if (!format_supported(images[i].subsamp) || images[i].display_width)
+                continue;
+
+            DataPacket *packet = decoder->pull_empty_packet(jpegs[i].size());
+            memcpy(packet->data, jpegs[i].data(), jpegs[i].size());
+            packet->used = jpegs[i].size();
+            packet->pts = (uint64_t) sent.size() * 33333;
+            const uint64_t pts = packet->pts;
+            sent.push_back(i);
+
+            if (!decoder->decode_video(&frame, packet, &got_output)) {
+                elog("Failed: decode_video");
+                failures++;
+            }
+            if (!decoder->holds_packets())
+                decoder->push_empty_packet(packet);
+
+            // inline decoding returns the frame right away
+            if (!decoder->holds_packets() && !got_output) {
+                elog("Failed: no output for packet %llu", (unsigned long long) pts);
+                failures++;
+            }
+
+            while (got_output) {
+                const size_t n = received++;
+                check_frame(&frame, &images[sent[n]], jpegs[sent[n]], (uint64_t) n * 33333);
+                if (decoder->frame_pts != (uint64_t) n * 33333) {
+                    elog("Failed: frame_pts %llu, expected %llu",
+                        (unsigned long long) decoder->frame_pts, (unsigned long long) n * 33333);
+                    failures++;
+                }
+                decoder->decode_video(&frame, NULL, &got_output);
+            }
+        }
+    }
+
+    // drain the workers
+    const uint64_t deadline = os_gettime_ns() + UINT64_C(5000000000);
+    while (received < sent.size() && os_gettime_ns() < deadline) {
+        decoder->decode_video(&frame, NULL, &got_output);
+        if (!got_output) {
+            os_sleep_ms(1);
+            continue;
+        }
+
+        const size_t n = received++;
+        check_frame(&frame, &images[sent[n]], jpegs[sent[n]], (uint64_t) n * 33333);
+        if (decoder->frame_pts != (uint64_t) n * 33333) {
+            elog("Failed: frame_pts %llu, expected %llu",
+                (unsigned long long) decoder->frame_pts, (unsigned long long) n * 33333);
+            failures++;
+        }
+    }
+
+    if (received != sent.size()) {
+        elog("Failed: %zu of %zu frames came out", received, sent.size());
+        failures++;
+    }
+
+    decoder->flush();
+    if (decoder->free_count() != decoder->alloc_count) {
+        elog("Failed: %zu of %zu packets returned", decoder->free_count(),
+            (size_t) decoder->alloc_count.load());
+        failures++;
+    }
+
+    delete decoder;
+    dlog("~test_decoder");
+}
+
+int main(int argc, char** argv) {
+    (void) argc;
+    (void) argv;
+
+    tjhandle tj = tjInitCompress();
+    std::vector<std::vector<uint8_t>> jpegs;
+    for (size_t i = 0; i < ARRAY_LEN(images); i++) {
+        jpegs.push_back(make_jpeg(tj, images[i].width, images[i].height, images[i].subsamp, (int) i));
+        if (jpegs.back().empty()) {
+            elog("Failed: could not encode test image %zu", i);
+            return 1;
+        }
+    }
+    tjDestroy(tj);
+
+    test_context(jpegs);
+    test_decoder(jpegs, THREADING_SLICE);
+    test_decoder(jpegs, THREADING_FRAME);
+
+    if (failures)
+        elog("%d failures", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,202 @@
+// Copyright (C) 2025 DEV47APPS, github.com/dev47apps
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "plugin.h"
+#include "nal_scan.h"
+
+static int failures;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Reference implementation to check the SIMD paths against
+static size_t naive_find(const uint8_t *p, size_t len, size_t i) {
+    for (; i + 3 <= len; i++) {
+        if (p[i] == 0 && p[i + 1] == 0 && p[i + 2] == 1)
+            return i;
+    }
+    return len;
+}
+
+// Random slice payload with emulation prevention applied, like an encoder's output
+static void append_payload(std::vector<uint8_t> &au, size_t len, unsigned *seed) {
+    int zeros = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint8_t b = (uint8_t) rand_r(seed);
+        if (rand_r(seed) % 8 == 0) b = 0; // real slices have plenty of zero bytes
+
+        if (zeros >= 2 && b <= 3) {
+            au.push_back(3);
+            zeros = 0;
+        }
+
+        au.push_back(b);
+        zeros = b == 0 ? zeros + 1 : 0;
+    }
+    au.push_back(0x80); // rbsp trailing bits
+}
+
+static void append_nal(std::vector<uint8_t> &au, const uint8_t *header, size_t header_len,
+    size_t payload, unsigned *seed)
+{
+    static const uint8_t start[] = {0, 0, 0, 1};
+    au.insert(au.end(), start, start + sizeof(start));
+    au.insert(au.end(), header, header + header_len);
+    append_payload(au, payload, seed);
+}
+
+// AUD + SPS + PPS + IDR slice, or AUD + slice
+static std::vector<uint8_t> make_avc_au(bool idr, size_t slice_len, unsigned *seed) {
+    static const uint8_t aud[] = {0x09}, sps[] = {0x67}, pps[] = {0x68};
+    static const uint8_t idr_slice[] = {0x65}, ref_slice[] = {0x41};
+    std::vector<uint8_t> au;
+    append_nal(au, aud, sizeof(aud), 1, seed);
+    if (idr) {
+        append_nal(au, sps, sizeof(sps), 12, seed);
+        append_nal(au, pps, sizeof(pps), 4, seed);
+    }
+    append_nal(au, idr ? idr_slice : ref_slice, 1, slice_len, seed);
+    return au;
+}
+
+void test_start_codes(void) {
+    ilog("test_start_codes()");
+    unsigned seed = 47;
+
+    // dense: lots of 00 00 01 and near misses at every alignment
+    std::vector<uint8_t> buf(1 << 16);
+    for (size_t i = 0; i < buf.size(); i++)
+        buf[i] = (uint8_t) (rand_r(&seed) % 3);
+
+    for (size_t start = 0; start < 64; start++) {
+        for (size_t len = buf.size() - 64; len <= buf.size(); len += 7) {
+            size_t i = start, j = start;
+            do {
+                i = nal_find_start_code(buf.data(), len, i);
+                j = naive_find(buf.data(), len, j);
+                if (i != j) {
+                    elog("Failed: start=%zu len=%zu: found %zu, expected %zu", start, len, i, j);
+                    failures++;
+                    return;
+                }
+                i++; j++;
+            } while (i < len);
+        }
+    }
+
+    // start code straddling the end, and at the very end
+    const uint8_t tail[] = {5, 5, 5, 0, 0, 1};
+    if (nal_find_start_code(tail, sizeof(tail), 0) != 3
+        || nal_find_start_code(tail, sizeof(tail) - 1, 0) != sizeof(tail) - 1) {
+        elog("Failed: start code at the end of the buffer");
+        failures++;
+    }
+
+    dlog("~test_start_codes");
+}
+
+void test_classify(void) {
+    ilog("test_classify()");
+    unsigned seed = 4747;
+    struct {
+        bool hevc;
+        uint8_t header[2];
+        FrameType expected;
+    } cases[] = {
+        {false, {0x65, 0}, FRAME_IDR},
+        {false, {0x41, 0}, FRAME_REF},
+        {false, {0x01, 0}, FRAME_NONREF},
+        {false, {0x06, 0}, FRAME_UNKNOWN}, // SEI only
+        {true, {19 << 1, 1}, FRAME_IDR},
+        {true, {21 << 1, 1}, FRAME_CRA},
+        {true, {1 << 1, 1}, FRAME_REF},
+        {true, {0 << 1, 1}, FRAME_NONREF},
+        {true, {35 << 1, 1}, FRAME_UNKNOWN}, // AUD only
+    };
+
+    for (size_t i = 0; i < ARRAY_LEN(cases); i++) {
+        std::vector<uint8_t> au;
+        const uint8_t aud_avc[] = {0x09}, aud_hevc[] = {35 << 1, 1};
+        if (cases[i].hevc)
+            append_nal(au, aud_hevc, sizeof(aud_hevc), 1, &seed);
+        else
+            append_nal(au, aud_avc, sizeof(aud_avc), 1, &seed);
+
+        append_nal(au, cases[i].header, cases[i].hevc ? 2 : 1, 1000, &seed);
+        FrameType t = nal_classify(au.data(), au.size(), cases[i].hevc);
+        if (t != cases[i].expected) {
+            elog("Failed: case %zu: got %s, expected %s", i,
+                frame_type_name(t), frame_type_name(cases[i].expected));
+            failures++;
+        }
+    }
+
+    dlog("~test_classify");
+}
+
+// Bytes/sec of nal_classify() over typical access units
+void bench_classify(const char *name, size_t slice_len, bool idr) {
+    unsigned seed = 1;
+    std::vector<std::vector<uint8_t>> aus;
+    size_t total = 0;
+    for (int i = 0; i < 16; i++) {
+        aus.push_back(make_avc_au(idr, slice_len, &seed));
+        total += aus.back().size();
+    }
+
+    // ~256MB per run, best of 5
+    const int rounds = (int) ((256u << 20) / total) + 1;
+    double best = 0;
+    int sink = 0;
+    for (int run = 0; run < 5; run++) {
+        const uint64_t start = now_ns();
+        for (int r = 0; r < rounds; r++) {
+            for (const std::vector<uint8_t> &au : aus)
+                sink += nal_classify(au.data(), au.size(), false);
+        }
+        const double mbps = (double) total * rounds * 1000.0 / (double) (now_ns() - start);
+        if (mbps > best) best = mbps;
+    }
+
+    ilog("nal_classify %-12s %7zu byte AUs: %8.1f MB/s (%d)", name, total / aus.size(), best, sink & 1);
+}
+
+void bench_naive(size_t slice_len) {
+    unsigned seed = 1;
+    std::vector<uint8_t> au = make_avc_au(false, slice_len, &seed);
+    const int rounds = (int) ((256u << 20) / au.size()) + 1;
+    size_t sink = 0;
+
+    const uint64_t start = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = naive_find(au.data(), au.size(), 0); i < au.size();
+             i = naive_find(au.data(), au.size(), i + 3))
+            sink += i;
+    }
+    const double mbps = (double) au.size() * rounds * 1000.0 / (double) (now_ns() - start);
+    ilog("naive scan   %-12s %7zu byte AUs: %8.1f MB/s (%d)", "p-frame", au.size(), mbps, (int) (sink & 1));
+}
+
+int main(int argc, char** argv) {
+    (void) argc;
+    (void) argv;
+
+    test_start_codes();
+    test_classify();
+
+    bench_classify("p-frame", 16 * 1024, false);
+    bench_classify("p-frame-4k", 96 * 1024, false);
+    bench_classify("idr", 256 * 1024, true);
+    bench_naive(16 * 1024);
+
+    if (failures)
+        elog("%d failures", failures);
+    return failures ? 1 : 0;
+}
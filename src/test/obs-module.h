@@ -3,6 +3,12 @@
 #define LOG_ERROR 0
 #define LOG_WARNING 1
 
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+#define bmalloc malloc
+#define brealloc realloc
+#define bfree free
 
 #define blog(log_level, fmt, ...) fprintf(stderr, fmt "\n", ##__VA_ARGS__)
@@ -0,0 +1,128 @@
+// Copyright (C) 2025 DEV47APPS, github.com/dev47apps
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "plugin.h"
+#include "decoder.h"
+
+// Packet handoff between the receive and decode threads: the lock-free
+// SPSCQueue used by Decoder against the mutex/deque Queue it replaced.
+// Each item carries the time it was pushed, the consumer records how long
+// it took to come out.
+
+#define ITEMS 1000000
+#define PACED_ITEMS 100000
+#define PACED_INTERVAL_NS 2000
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Spin briefly, then let the other side run (matters with few cores)
+static inline void relax(int *spins) {
+    if (++*spins > 64) {
+        *spins = 0;
+        sched_yield();
+    }
+}
+
+struct SpscAdapter {
+    SPSCQueue<uint64_t, DECODE_QUEUE_SIZE> q;
+    bool push(uint64_t v) { return q.push(v); }
+    uint64_t pop(void) { return q.pop(); }
+};
+
+struct LockedAdapter {
+    Queue<uint64_t> q;
+    bool push(uint64_t v) { q.add_item(v); return true; }
+    uint64_t pop(void) { return q.next_item(); }
+};
+
+template<typename Q>
+struct Run {
+    Q queue;
+    int items;
+    uint64_t interval_ns; // 0 = as fast as possible
+    std::vector<uint64_t> latency;
+    uint64_t elapsed_ns;
+};
+
+template<typename Q>
+static void *producer(void *data) {
+    Run<Q> *run = (Run<Q>*) data;
+    uint64_t next = now_ns();
+    int spins = 0;
+    for (int i = 0; i < run->items; i++) {
+        if (run->interval_ns) {
+            while (now_ns() < next)
+                relax(&spins);
+            next += run->interval_ns;
+        }
+
+        while (!run->queue.push(now_ns()))
+            relax(&spins);
+    }
+    return 0;
+}
+
+template<typename Q>
+static void measure(const char *name, int items, uint64_t interval_ns) {
+    Run<Q> *run = new Run<Q>();
+    run->items = items;
+    run->interval_ns = interval_ns;
+    run->latency.reserve(items);
+
+    pthread_t thread;
+    const uint64_t start = now_ns();
+    pthread_create(&thread, NULL, producer<Q>, run);
+
+    int spins = 0;
+    for (int i = 0; i < items;) {
+        uint64_t ts = run->queue.pop();
+        if (!ts) {
+            relax(&spins);
+            continue;
+        }
+
+        run->latency.push_back(now_ns() - ts);
+        i++;
+    }
+
+    run->elapsed_ns = now_ns() - start;
+    pthread_join(thread, NULL);
+
+    std::vector<uint64_t> &l = run->latency;
+    std::sort(l.begin(), l.end());
+    ilog("%-7s %-6s %5.1f M items/s  latency ns: p50=%llu p99=%llu p99.9=%llu max=%llu",
+        name, interval_ns ? "paced" : "burst",
+        (double) items * 1000.0 / (double) run->elapsed_ns,
+        (unsigned long long) l[l.size() / 2],
+        (unsigned long long) l[l.size() * 99 / 100],
+        (unsigned long long) l[l.size() * 999 / 1000],
+        (unsigned long long) l.back());
+
+    delete run;
+}
+
+int main(int argc, char** argv) {
+    (void) argc;
+    (void) argv;
+    ilog("queue_bench: %ld cores", sysconf(_SC_NPROCESSORS_ONLN));
+
+    // burst: throughput, and latency under backlog
+    measure<SpscAdapter>("spsc", ITEMS, 0);
+    measure<LockedAdapter>("locked", ITEMS, 0);
+
+    // paced: handoff cost with an empty queue, the usual case at 30-60 fps
+    measure<SpscAdapter>("spsc", PACED_ITEMS, PACED_INTERVAL_NS);
+    measure<LockedAdapter>("locked", PACED_ITEMS, PACED_INTERVAL_NS);
+    return 0;
+}